@@ -28,21 +28,14 @@
 #include "group-member.h"
 #include "stat-macros.h"
 
-/* Return true if the current user has permission of type MODE
-   on the file from which stat buffer *ST was obtained, ignoring
-   ACLs, attributes, `read-only'ness, etc...
-   Otherwise, return false.
-
-   Like the reentrant version of euidaccess, but starting with
-   a stat buffer rather than a file name.  Hence, this function
-   never calls access or accessx, and doesn't take into account
-   whether the file has ACLs or other attributes, or resides on
-   a read-only file system.  */
-
-bool
-euidaccess_stat (struct stat const *st, int mode)
+/* Return true if the user EUID has permission of type MODE on the file
+   whose status is *ST, with IN_GROUP (GID, ARG) telling whether the
+   user is in the group GID.  */
+static bool
+access_granted (struct stat const *st, int mode, uid_t euid,
+                bool (*in_group) (gid_t gid, void const *arg),
+                void const *arg)
 {
-  uid_t euid;
   unsigned int granted;
 
   /* Convert the mode to traditional form, clearing any bogus bits.  */
@@ -56,8 +49,6 @@ euidaccess_stat (struct stat const *st, int mode)
   if (mode == 0)
     return true;		/* The file exists.  */
 
-  euid = geteuid ();
-
   /* The super-user can read and write any file, and execute any file
      that anyone can execute.  */
   if (euid == 0 && ((mode & X_OK) == 0
@@ -88,12 +79,8 @@ euidaccess_stat (struct stat const *st, int mode)
 
   if (euid == st->st_uid)
     granted >>= 6;
-  else
-    {
-      gid_t egid = getegid ();
-      if (egid == st->st_gid || group_member (st->st_gid))
-        granted >>= 3;
-    }
+  else if (in_group (st->st_gid, arg))
+    granted >>= 3;
 
   if ((mode & ~granted) == 0)
     return true;
@@ -101,6 +88,54 @@ euidaccess_stat (struct stat const *st, int mode)
   return false;
 }
 
+static bool
+process_in_group (gid_t gid, void const *arg)
+{
+  (void) arg;
+  return getegid () == gid || group_member (gid);
+}
+
+static bool
+cred_in_group (gid_t gid, void const *arg)
+{
+  struct euidaccess_cred const *cred = arg;
+  size_t i;
+
+  if (cred->egid == gid)
+    return true;
+  for (i = 0; i < cred->n_groups; i++)
+    if (cred->groups[i] == gid)
+      return true;
+  return false;
+}
+
+/* Return true if the current user has permission of type MODE
+   on the file from which stat buffer *ST was obtained, ignoring
+   ACLs, attributes, `read-only'ness, etc...
+   Otherwise, return false.
+
+   Like the reentrant version of euidaccess, but starting with
+   a stat buffer rather than a file name.  Hence, this function
+   never calls access or accessx, and doesn't take into account
+   whether the file has ACLs or other attributes, or resides on
+   a read-only file system.  */
+
+bool
+euidaccess_stat (struct stat const *st, int mode)
+{
+  return access_granted (st, mode, geteuid (), process_in_group, NULL);
+}
+
+/* Like euidaccess_stat, but for the credentials *CRED rather than
+   those of the process, so that a caller checking many files need
+   look them up only once.  */
+
+bool
+euidaccess_stat_as (struct stat const *st, int mode,
+                    struct euidaccess_cred const *cred)
+{
+  return access_granted (st, mode, cred->euid, cred_in_group, cred);
+}
 
 #ifdef TEST
 # include <errno.h>
@@ -2,4 +2,16 @@
 #include <sys/stat.h>
 #include <stdbool.h>
 
+/* The credentials that euidaccess_stat_as checks access for: an
+   effective user and group ID, and N_GROUPS supplementary groups.  */
+struct euidaccess_cred
+{
+  uid_t euid;
+  gid_t egid;
+  gid_t const *groups;
+  size_t n_groups;
+};
+
 bool euidaccess_stat (struct stat const *st, int mode);
+bool euidaccess_stat_as (struct stat const *st, int mode,
+                         struct euidaccess_cred const *cred);
@@ -60,6 +60,22 @@ will attempt to deduce when either
 or
 .B ``cd D; rm *''
 has been performed and will issue a warning and prompt.
+With \fI\-r\fR, \fI\-R\fR, or \fI\-\-recursive\fR,
+.B rm
+will also warn and prompt before removing anything in a directory
+that holds a file named \fI.rmfd-protect\fR, and leave the directory
+alone if the user declines.
+.P
+With \fI\-\-warnings\-policy\fR,
+.B rm
+does not prompt, but lists each protected file on standard output and
+acts as its argument says:
+.B deny
+as if the user declined,
+.B allow
+as if the user agreed, and
+.B report
+removes nothing at all.
 .SH OPTIONS
 [SEE ALSO]
 unlink(1), unlink(2), chattr(1), shred(1)
@@ -0,0 +1,154 @@
+/* dev-ino-table.c -- a flat hash table keyed by device and inode number
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Nearly every lookup rm makes in the warnings table is a miss, so the
+   table is laid out for those: a prefilter that answers most misses
+   from one cache line, then linear probing over an array of keys,
+   rather than chasing bucket and overflow pointers.  Nothing is ever
+   removed, so there are no tombstones.  */
+
+#include <config.h>
+#include <sys/types.h>
+
+#include "system.h"
+#include "dev-ino-table.h"
+
+/* The values stored in a table are usually allocated from its arena,
+   in chunks of this many bytes.  */
+enum { DEV_INO_ARENA_CHUNK = 64 * 1024 };
+
+union dev_ino_align
+{
+  void *p;
+  uintmax_t u;
+  long double d;
+};
+
+struct dev_ino_arena
+{
+  struct dev_ino_arena *prev;
+  size_t used;
+  size_t size;
+  union dev_ino_align data[1];
+};
+
+/* Put VALUE in the first free slot for H.  It must not be there yet.  */
+static void
+place (struct dev_ino_table *table, uint64_t h, dev_t dev, ino_t ino,
+       void *value)
+{
+  size_t mask = table->size - 1;
+  size_t i;
+
+  for (i = h & mask; table->slot[i].value; i = (i + 1) & mask)
+    continue;
+  table->slot[i].dev = dev;
+  table->slot[i].ino = ino;
+  table->slot[i].value = value;
+  dev_ino_filter_set (table->filter, table->n_filter_blocks, h);
+}
+
+/* Make room for SIZE slots, at 8 filter bits per slot, and rehash.  */
+static void
+resize (struct dev_ino_table *table, size_t size)
+{
+  struct dev_ino_slot *old = table->slot;
+  size_t old_size = table->size;
+  size_t i;
+
+  table->slot = xcalloc (size, sizeof *table->slot);
+  table->size = size;
+  free (table->filter);
+  table->n_filter_blocks = MAX (1, size / 64);
+  table->filter = xcalloc (table->n_filter_blocks, sizeof *table->filter);
+
+  for (i = 0; i < old_size; i++)
+    if (old[i].value)
+      place (table, dev_ino_hash (old[i].dev, old[i].ino),
+             old[i].dev, old[i].ino, old[i].value);
+  free (old);
+}
+
+struct dev_ino_table *
+dev_ino_table_create (void)
+{
+  struct dev_ino_table *table = xmalloc (sizeof *table);
+  table->slot = NULL;
+  table->size = 0;
+  table->n_entries = 0;
+  table->filter = NULL;
+  table->arena = NULL;
+  resize (table, 64);
+  return table;
+}
+
+void
+dev_ino_table_free (struct dev_ino_table *table)
+{
+  struct dev_ino_arena *a = table->arena;
+  while (a)
+    {
+      struct dev_ino_arena *prev = a->prev;
+      free (a);
+      a = prev;
+    }
+  free (table->slot);
+  free (table->filter);
+  free (table);
+}
+
+/* Return SIZE bytes of memory, suitably aligned, that live as long as
+   TABLE.  */
+void *
+dev_ino_table_alloc (struct dev_ino_table *table, size_t size)
+{
+  struct dev_ino_arena *a = table->arena;
+  size_t align = sizeof a->data[0];
+
+  size = (size + align - 1) / align * align;
+  if (! a || a->size - a->used < size)
+    {
+      size_t chunk = MAX (size, DEV_INO_ARENA_CHUNK);
+      a = xmalloc (offsetof (struct dev_ino_arena, data) + chunk);
+      a->prev = table->arena;
+      a->used = 0;
+      a->size = chunk;
+      table->arena = a;
+    }
+
+  void *p = (char *) a->data + a->used;
+  a->used += size;
+  return p;
+}
+
+/* Store VALUE, which must not be NULL, under DEV and INO, unless some
+   value is already stored there.  Return the value stored there.  */
+void *
+dev_ino_table_insert (struct dev_ino_table *table, dev_t dev, ino_t ino,
+                      void *value)
+{
+  void *found = dev_ino_table_lookup (table, dev, ino);
+  if (found)
+    return found;
+
+  /* Keep the load factor at most 1/2, so probe sequences stay short.  */
+  if (table->size / 2 <= table->n_entries)
+    resize (table, table->size * 2);
+  place (table, dev_ino_hash (dev, ino), dev, ino, value);
+  table->n_entries++;
+  return value;
+}
@@ -0,0 +1,135 @@
+/* A flat hash table keyed by device and inode number.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef DEV_INO_TABLE_H
+# define DEV_INO_TABLE_H
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+# include <sys/types.h>
+
+struct dev_ino_slot
+{
+  dev_t dev;
+  ino_t ino;
+  /* The value stored under DEV and INO, or NULL for an empty slot.  */
+  void *value;
+};
+
+/* The prefilter is a blocked Bloom filter: each key sets a few bits
+   in a single 64-byte block, so testing for a key that is not in the
+   table touches one cache line.  */
+enum { DEV_INO_FILTER_WORDS = 8 };
+struct dev_ino_filter_block
+{
+  uint64_t word[DEV_INO_FILTER_WORDS];
+};
+
+struct dev_ino_arena;
+
+struct dev_ino_table
+{
+  /* SIZE slots, where SIZE is a power of two.  */
+  struct dev_ino_slot *slot;
+  size_t size;
+  size_t n_entries;
+  /* SIZE / 64 filter blocks, but at least one.  */
+  struct dev_ino_filter_block *filter;
+  size_t n_filter_blocks;
+  /* Where dev_ino_table_alloc carves out memory.  */
+  struct dev_ino_arena *arena;
+};
+
+extern struct dev_ino_table *dev_ino_table_create (void);
+extern void dev_ino_table_free (struct dev_ino_table *table);
+extern void *dev_ino_table_alloc (struct dev_ino_table *table, size_t size);
+extern void *dev_ino_table_insert (struct dev_ino_table *table,
+                                   dev_t dev, ino_t ino, void *value);
+
+/* Mix DEV and INO into a 64-bit hash.  */
+static inline uint64_t
+dev_ino_hash (dev_t dev, ino_t ino)
+{
+  uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15ULL;
+  h ^= (uint64_t) dev * 0xc2b2ae3d27d4eb4fULL + (h >> 29);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Set H's three bits in FILTER, of N_BLOCKS blocks, a power of two.
+   The block is chosen by the high half of H and the bits within it by
+   the low half.  */
+static inline void
+dev_ino_filter_set (struct dev_ino_filter_block *filter, size_t n_blocks,
+                    uint64_t h)
+{
+  struct dev_ino_filter_block *b = &filter[(h >> 32) & (n_blocks - 1)];
+  b->word[h & 7] |= (uint64_t) 1 << ((h >> 3) & 63);
+  b->word[(h >> 9) & 7] |= (uint64_t) 1 << ((h >> 12) & 63);
+  b->word[(h >> 18) & 7] |= (uint64_t) 1 << ((h >> 21) & 63);
+}
+
+/* Return true if FILTER, of N_BLOCKS blocks, has all three of H's bits
+   set.  */
+static inline bool
+dev_ino_filter_get (struct dev_ino_filter_block const *filter,
+                    size_t n_blocks, uint64_t h)
+{
+  struct dev_ino_filter_block const *b = &filter[(h >> 32) & (n_blocks - 1)];
+  return (((b->word[h & 7] >> ((h >> 3) & 63))
+           & (b->word[(h >> 9) & 7] >> ((h >> 12) & 63))
+           & (b->word[(h >> 18) & 7] >> ((h >> 21) & 63)))
+          & 1);
+}
+
+/* Return true if the filter of TABLE has all three of H's bits set.  */
+static inline bool
+dev_ino_filter_test (struct dev_ino_table const *table, uint64_t h)
+{
+  return dev_ino_filter_get (table->filter, table->n_filter_blocks, h);
+}
+
+/* Return true if the table may contain DEV and INO, consulting only
+   the prefilter.  A false return is definitive.  */
+static inline bool
+dev_ino_table_may_contain (struct dev_ino_table const *table,
+                           dev_t dev, ino_t ino)
+{
+  return dev_ino_filter_test (table, dev_ino_hash (dev, ino));
+}
+
+/* Return the value stored under DEV and INO, or NULL if there is none.  */
+static inline void *
+dev_ino_table_lookup (struct dev_ino_table const *table, dev_t dev, ino_t ino)
+{
+  uint64_t h = dev_ino_hash (dev, ino);
+  size_t mask = table->size - 1;
+  size_t i;
+
+  if (! dev_ino_filter_test (table, h))
+    return NULL;
+
+  for (i = h & mask; table->slot[i].value; i = (i + 1) & mask)
+    if (table->slot[i].ino == ino && table->slot[i].dev == dev)
+      return table->slot[i].value;
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,182 @@
+/* An index of the mount points under the files being removed.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* A bind mount of a directory on the same file system has the same
+   device number as the directory it is mounted on, so comparing
+   device numbers doesn't find it.  The kernel lists every mount point
+   in /proc/self/mountinfo, though.  The mount points under the files
+   being removed are indexed by the device and inode numbers of what
+   is mounted there, which rm already has for each directory it
+   visits, and only a directory that matches has its name checked.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "system.h"
+#include "dev-ino-table.h"
+#include "mount-table.h"
+
+/* A mount point, one of those where the same file is mounted.  */
+struct mount_point
+{
+  struct mount_point *next;
+  char dir[1];
+};
+
+struct mount_table
+{
+  /* The mount points, by the device and inode numbers of the root of
+     what is mounted on them.  */
+  struct dev_ino_table *roots;
+};
+
+/* Undo the octal escapes with which the kernel writes spaces, tabs,
+   newlines and backslashes in the fields of mountinfo, in place.  */
+static void
+unescape (char *s)
+{
+  char *d = s;
+
+  for (; *s; s++)
+    if (s[0] == '\\'
+        && '0' <= s[1] && s[1] <= '3'
+        && '0' <= s[2] && s[2] <= '7'
+        && '0' <= s[3] && s[3] <= '7')
+      {
+        *d++ = (s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0');
+        s += 3;
+      }
+    else
+      *d++ = *s;
+  *d = '\0';
+}
+
+/* Return true if DIR is PREFIX or under it.  */
+static bool
+dir_under (char const *dir, char const *prefix)
+{
+  size_t len = strlen (prefix);
+
+  if (len == 1)
+    return true;
+  return (strncmp (dir, prefix, len) == 0
+          && (dir[len] == '\0' || dir[len] == '/'));
+}
+
+/* Read /proc/self/mountinfo and index the mount points that are FILE,
+   a NULL-terminated list of file names, or under any of them.  Return
+   NULL if the list of mount points can't be read.  */
+struct mount_table *
+mount_table_load (char *const *file)
+{
+  FILE *fp = fopen ("/proc/self/mountinfo", "r");
+  if (!fp)
+    return NULL;
+
+  size_t n_files = 0;
+  while (file[n_files])
+    n_files++;
+  char **prefix = xnmalloc (n_files, sizeof *prefix);
+  size_t n_prefixes = 0;
+  size_t i;
+  for (i = 0; i < n_files; i++)
+    if ((prefix[n_prefixes] = canonicalize_file_name (file[i])))
+      n_prefixes++;
+
+  struct mount_table *table = xmalloc (sizeof *table);
+  table->roots = dev_ino_table_create ();
+
+  char *line = NULL;
+  size_t line_size = 0;
+  while (getline (&line, &line_size, fp) != -1)
+    {
+      /* The mount point is the fifth field.  */
+      char *dir = line;
+      int field;
+      for (field = 1; field < 5 && dir; field++)
+        {
+          dir = strchr (dir, ' ');
+          if (dir)
+            dir++;
+        }
+      if (!dir)
+        continue;
+      dir[strcspn (dir, " \n")] = '\0';
+      unescape (dir);
+
+      for (i = 0; i < n_prefixes; i++)
+        if (dir_under (dir, prefix[i]))
+          break;
+      struct stat st;
+      if (i == n_prefixes || stat (dir, &st) != 0)
+        continue;
+
+      size_t dir_len = strlen (dir);
+      struct mount_point *mp =
+        dev_ino_table_alloc (table->roots,
+                             offsetof (struct mount_point, dir) + dir_len + 1);
+      memcpy (mp->dir, dir, dir_len + 1);
+      mp->next = NULL;
+      struct mount_point *first =
+        dev_ino_table_insert (table->roots, st.st_dev, st.st_ino, mp);
+      if (first != mp)
+        {
+          mp->next = first->next;
+          first->next = mp;
+        }
+    }
+
+  free (line);
+  fclose (fp);
+  for (i = 0; i < n_prefixes; i++)
+    free (prefix[i]);
+  free (prefix);
+  return table;
+}
+
+void
+mount_table_free (struct mount_table *table)
+{
+  if (table)
+    {
+      dev_ino_table_free (table->roots);
+      free (table);
+    }
+}
+
+/* Return true if FILE, a directory whose status is *ST, is one of the
+   mount points in TABLE.  */
+bool
+mount_table_is_mount_point (struct mount_table const *table,
+                            char const *file, struct stat const *st)
+{
+  struct mount_point const *mp =
+    dev_ino_table_lookup (table->roots, st->st_dev, st->st_ino);
+  if (!mp)
+    return false;
+
+  /* The same directory may also be where it was bound from.  */
+  char *name = canonicalize_file_name (file);
+  if (!name)
+    return false;
+  for (; mp; mp = mp->next)
+    if (STREQ (mp->dir, name))
+      break;
+  free (name);
+  return mp != NULL;
+}
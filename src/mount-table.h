@@ -0,0 +1,33 @@
+/* An index of the mount points under the files being removed.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef MOUNT_TABLE_H
+# define MOUNT_TABLE_H
+
+# include <stdbool.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+
+struct mount_table;
+
+extern struct mount_table *mount_table_load (char *const *file);
+extern void mount_table_free (struct mount_table *table);
+extern bool mount_table_is_mount_point (struct mount_table const *table,
+                                        char const *file,
+                                        struct stat const *st);
+
+#endif
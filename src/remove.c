@@ -18,24 +18,35 @@
 
 #include <config.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <assert.h>
+#ifdef __linux__
+# include <sys/vfs.h>
+# include <sys/xattr.h>
+#endif
 
 #include "system.h"
 #include "concat-filename.h"
-#include "error.h"
 #include "euidaccess-stat.h"
 #include "file-type.h"
 #include "quote.h"
+#include "quotearg.h"
+#include "hash.h"
+#include "dev-ino-table.h"
 #include "hash-pjw.h"
+#include "mount-table.h"
+#include "nproc.h"
 #include "remove.h"
 #include "root-dev-ino.h"
+#include "stat-time.h"
 #include "write-any-file.h"
 #include "xfts.h"
-#include "yesno.h"
+#include "xstrndup.h"
+#include "xvasprintf.h"
 
 typedef enum Ternary Ternary;
 
@@ -61,66 +72,483 @@ enum Prompt_action
 # define DT_LNK 2
 #endif
 
-/* Like fstatat, but cache the result.  If ST->st_size is -1, the
-   status has not been gotten yet.  If less than -1, fstatat failed
-   with errno == ST->st_ino.  Otherwise, the status has already
-   been gotten, so return 0.  */
+/* The fields of a stat_cache that can be asked for.  */
+#if HAVE_STATX
+# define SC_TYPE STATX_TYPE
+# define SC_MODE STATX_MODE
+# define SC_NLINK STATX_NLINK
+# define SC_UID STATX_UID
+# define SC_GID STATX_GID
+# define SC_INO STATX_INO
+# define SC_SIZE STATX_SIZE
+#else
+enum
+  {
+    SC_TYPE = 1 << 0,
+    SC_MODE = 1 << 1,
+    SC_NLINK = 1 << 2,
+    SC_UID = 1 << 3,
+    SC_GID = 1 << 4,
+    SC_INO = 1 << 5,
+    SC_SIZE = 1 << 6
+  };
+#endif
+#define SC_ALL (SC_TYPE | SC_MODE | SC_NLINK | SC_UID | SC_GID | SC_INO \
+                | SC_SIZE)
+
+/* The lstat information of a file, gotten a few fields at a time as
+   they are needed.  The device number is always valid once anything
+   is.  With statx, only the fields asked for are requested, which can
+   spare a network file system from revalidating the others.  */
+struct stat_cache
+{
+  /* The SC_* fields of ST that are valid.  */
+  unsigned int valid;
+  /* If nonzero, the errno value with which getting the status failed.  */
+  int err;
+  struct stat st;
+  /* Where to count the system calls made for the file, or NULL.  */
+  struct stats *stats;
+  enum stats_site site;
+};
+
+/* Initialize the cache *SC, whose system calls are counted as made
+   from SITE in STATS.  Return SC for convenience.  */
+static inline struct stat_cache *
+cache_stat_init (struct stat_cache *sc, struct stats *stats,
+                 enum stats_site site)
+{
+  sc->valid = 0;
+  sc->err = 0;
+  sc->stats = stats;
+  sc->site = site;
+  return sc;
+}
+
+/* Fill the cache *SC from *ST, a complete lstat result.  */
+static inline void
+cache_stat_set (struct stat_cache *sc, struct stat const *st)
+{
+  sc->st = *st;
+  sc->valid = SC_ALL;
+  sc->err = 0;
+}
+
+/* Return true if anything has been put in *SC, or failed to be.  */
+static inline bool
+cache_statted (struct stat_cache const *sc)
+{
+  return sc->valid != 0 || sc->err != 0;
+}
+
+/* Like fstatat with AT_SYMLINK_NOFOLLOW, but cache the result in *SC
+   and make sure only that the fields in WANT are valid.  Return 0 if
+   they are, and -1 with errno set if getting them failed, now or
+   before.  */
 static int
-cache_fstatat (int fd, char const *file, struct stat *st, int flag)
+cache_fstatat (int fd, char const *file, struct stat_cache *sc,
+               unsigned int want)
 {
-  if (st->st_size == -1 && fstatat (fd, file, st, flag) != 0)
+  if ((sc->valid & want) != want && ! sc->err)
+    {
+#if HAVE_STATX
+      struct statx stx;
+
+      /* The type and inode number of a file never change, so there
+         is no need to have them revalidated.  */
+      int sync = ((want & ~(SC_TYPE | SC_INO))
+                  ? AT_STATX_SYNC_AS_STAT : AT_STATX_DONT_SYNC);
+      stats_count (sc->stats, sc->site, STATS_FSTATAT);
+      if (statx (fd, file, AT_SYMLINK_NOFOLLOW | sync, want, &stx) != 0)
+        sc->err = errno;
+      else if ((stx.stx_mask & want) != want)
+        {
+          /* The file system can't supply some field on its own.  */
+          stats_count (sc->stats, sc->site, STATS_FSTATAT);
+          if (fstatat (fd, file, &sc->st, AT_SYMLINK_NOFOLLOW) != 0)
+            sc->err = errno;
+          else
+            sc->valid = SC_ALL;
+        }
+      else
+        {
+          sc->st.st_dev = makedev (stx.stx_dev_major, stx.stx_dev_minor);
+          if (stx.stx_mask & (STATX_TYPE | STATX_MODE))
+            sc->st.st_mode = stx.stx_mode;
+          if (stx.stx_mask & STATX_NLINK)
+            sc->st.st_nlink = stx.stx_nlink;
+          if (stx.stx_mask & STATX_UID)
+            sc->st.st_uid = stx.stx_uid;
+          if (stx.stx_mask & STATX_GID)
+            sc->st.st_gid = stx.stx_gid;
+          if (stx.stx_mask & STATX_INO)
+            sc->st.st_ino = stx.stx_ino;
+          if (stx.stx_mask & STATX_SIZE)
+            sc->st.st_size = stx.stx_size;
+          sc->valid |= stx.stx_mask & SC_ALL;
+        }
+#else
+      stats_count (sc->stats, sc->site, STATS_FSTATAT);
+      if (fstatat (fd, file, &sc->st, AT_SYMLINK_NOFOLLOW) != 0)
+        sc->err = errno;
+      else
+        sc->valid = SC_ALL;
+#endif
+    }
+
+  if (sc->err)
     {
-      st->st_size = -2;
-      st->st_ino = errno;
+      errno = sc->err;
+      return -1;
     }
-  if (0 <= st->st_size)
-    return 0;
-  errno = (int) st->st_ino;
-  return -1;
+  return 0;
+}
+
+/* How far the permission bits of the files on a file system tell
+   whether rm can write them.  */
+enum mode_verdict
+{
+  /* Not at all, as where a server or a FUSE daemon decides.  */
+  MODE_UNTRUSTED,
+  /* As write_protected_by_mode says, since a file may have an ACL.  */
+  MODE_ACLS,
+  /* Entirely, since the file system has no ACLs.  */
+  MODE_TRUSTED
+};
+
+enum { DEV_VERDICTS_MAX = 16 };
+
+/* The targets of recently seen symbolic links.  A slot is picked by
+   hashing the text of the link and, unless that is absolute, the
+   device and inode number of the directory holding the link, since
+   those determine the target.  In trees full of links to the same few
+   places, this saves resolving the same path over and over.  The
+   answer can be stale if something along the path changes while rm
+   runs, but removing a symlink never removes its target.  */
+enum { SYMLINK_CACHE_SIZE = 4096 };
+
+/* Links longer than this aren't cached.  */
+enum { SYMLINK_CACHE_TEXT_MAX = 256 };
+
+struct symlink_cache_slot
+{
+  dev_t dir_dev;
+  ino_t dir_ino;
+  /* The text of the link, or NULL for an empty slot.  */
+  char *text;
+  /* The target, if IS_DIR.  */
+  dev_t dev;
+  ino_t ino;
+  /* True if the target is a directory.  */
+  bool is_dir;
+};
+
+/* What the removals with one context find out once and keep, made
+   with the context, so that each one, like each job of rm --serve,
+   starts afresh, and removals with other contexts in other threads
+   are not disturbed.  */
+struct rm_caches
+{
+  /* Protects CRED, DEV_VERDICT and DIRENT_VERDICT.  */
+  pthread_mutex_t cred_lock;
+
+  /* What write_protected_non_symlink knows about the credentials of
+     rm, found out on first use.  */
+  struct
+  {
+    bool known;
+    /* The effective user and group IDs, and the supplementary groups.  */
+    struct euidaccess_cred id;
+    /* False if the supplementary groups could not be found out.  */
+    bool groups_known;
+    /* True if rm may be able to write files regardless of their
+       permission bits, without being root.  */
+    bool dac_override;
+  } cred;
+
+  /* The verdicts on the file systems rm has checked files on.  */
+  struct
+  {
+    dev_t dev;
+    enum mode_verdict verdict;
+  } dev_verdict[DEV_VERDICTS_MAX];
+  size_t n_dev_verdicts;
+
+  /* The file systems whose directory entries can be trusted for the
+     device and inode numbers of the non-directories in them, and
+     those whose can not.  */
+  struct
+  {
+    dev_t dev;
+    bool trusted;
+  } dirent_verdict[DEV_VERDICTS_MAX];
+  size_t n_dirent_verdicts;
+
+  /* Protects SYMLINK_CACHE.  */
+  pthread_mutex_t symlink_cache_lock;
+  struct symlink_cache_slot symlink_cache[SYMLINK_CACHE_SIZE];
+};
+
+/* Return new, empty caches for a context.  */
+struct rm_caches *
+rm_caches_new (void)
+{
+  struct rm_caches *c = xzalloc (sizeof *c);
+  pthread_mutex_init (&c->cred_lock, NULL);
+  pthread_mutex_init (&c->symlink_cache_lock, NULL);
+  return c;
 }
 
-/* Initialize a fstatat cache *ST.  Return ST for convenience.  */
-static inline struct stat *
-cache_stat_init (struct stat *st)
+/* Free the caches C.  */
+void
+rm_caches_free (struct rm_caches *c)
 {
-  st->st_size = -1;
-  return st;
+  size_t i;
+
+  for (i = 0; i < SYMLINK_CACHE_SIZE; i++)
+    free (c->symlink_cache[i].text);
+  free ((gid_t *) c->cred.id.groups);
+  pthread_mutex_destroy (&c->symlink_cache_lock);
+  pthread_mutex_destroy (&c->cred_lock);
+  free (c);
 }
 
-/* Return true if *ST has been statted.  */
-static inline bool
-cache_statted (struct stat *st)
+/* Return true if rm might have the CAP_DAC_OVERRIDE capability.  */
+static bool
+may_override_dac (void)
 {
-  return (st->st_size != -1);
+#ifdef __linux__
+  FILE *fp = fopen ("/proc/self/status", "r");
+  char line[256];
+  bool found = false;
+  unsigned long long cap_eff = 0;
+
+  if (!fp)
+    return true;
+  while (!found && fgets (line, sizeof line, fp))
+    found = sscanf (line, "CapEff: %llx", &cap_eff) == 1;
+  fclose (fp);
+
+  /* CAP_DAC_OVERRIDE is capability number 1.  */
+  return !found || (cap_eff & (1 << 1));
+#else
+  return false;
+#endif
 }
 
-/* Return true if *ST has been statted successfully.  */
-static inline bool
-cache_stat_ok (struct stat *st)
+/* Find out the credentials of rm into C, unless already known.  The
+   caller holds C's cred_lock.  */
+static void
+know_cred (struct rm_caches *c)
+{
+  if (c->cred.known)
+    return;
+  c->cred.id.euid = geteuid ();
+  c->cred.id.egid = getegid ();
+  int n = getgroups (0, NULL);
+  gid_t *groups = 0 < n ? xnmalloc (n, sizeof *groups) : NULL;
+  if (groups)
+    n = getgroups (n, groups);
+  c->cred.groups_known = 0 <= n;
+  c->cred.id.groups = groups;
+  c->cred.id.n_groups = MAX (n, 0);
+  c->cred.dac_override = may_override_dac ();
+  c->cred.known = true;
+}
+
+/* Return 1 if the permission bits in *ST say that rm can't write to
+   the file, 0 if they say it can, and -1 if they can't tell, with the
+   credentials in C.  With ACLS, the file may have an ACL.
+
+   The owner of a file gets exactly its owner permission bits, even
+   when the file has an ACL, so those decide for a file that rm owns.
+   For anyone else the group bits of a file with an ACL are its mask,
+   which limits every entry but the owner's and the others', so with
+   neither group nor other write permission the file is unwritable.
+   A positive answer would need the ACL itself.  */
+static int
+write_protected_by_mode (struct rm_caches const *c, struct stat const *st,
+                         bool acls)
+{
+  if (st->st_uid != c->cred.id.euid
+      && (st->st_mode & (S_IWGRP | S_IWOTH))
+      && (acls || ! c->cred.groups_known))
+    return -1;
+
+  bool writable = euidaccess_stat_as (st, W_OK, &c->cred.id);
+  if (!writable && c->cred.dac_override)
+    return -1;
+  return !writable;
+}
+
+/* Return the verdict on the permission bits of the files on the file
+   system DEV, asking statfs and looking for ACL support once for each
+   device, and keeping the answer in C.  FD_CWD is the directory the
+   file is in, which is on the file system to look at unless the file
+   is a mount point, in which case return MODE_UNTRUSTED without
+   recording a verdict.  Remote and FUSE file systems decide for
+   themselves, whatever the permission bits say.  */
+static enum mode_verdict
+mode_verdict_of (struct rm_caches *c, int fd_cwd, dev_t dev)
+{
+#ifdef __linux__
+  struct stat dir_st;
+  struct statfs sfs;
+  enum mode_verdict verdict;
+  size_t i;
+
+  pthread_mutex_lock (&c->cred_lock);
+  for (i = 0; i < c->n_dev_verdicts; i++)
+    if (c->dev_verdict[i].dev == dev)
+      {
+        verdict = c->dev_verdict[i].verdict;
+        pthread_mutex_unlock (&c->cred_lock);
+        return verdict;
+      }
+  pthread_mutex_unlock (&c->cred_lock);
+
+  if (fstatat (fd_cwd, ".", &dir_st, 0) != 0 || dir_st.st_dev != dev
+      || (fd_cwd == AT_FDCWD ? statfs (".", &sfs) : fstatfs (fd_cwd, &sfs))
+         != 0)
+    return MODE_UNTRUSTED;
+  switch (sfs.f_type)
+    {
+    case 0x6969:		/* NFS */
+    case 0x517B:		/* SMB */
+    case 0xFF534D42:		/* CIFS */
+    case 0xFE534D42:		/* SMB2 */
+    case 0x65735546:		/* FUSE */
+    case 0x01021997:		/* 9P */
+    case 0x00C36400:		/* Ceph */
+    case 0x5346414F:		/* AFS */
+    case 0x73757245:		/* Coda */
+    case 0x794C7630:		/* overlayfs */
+    case 0x61756673:		/* aufs */
+      verdict = MODE_UNTRUSTED;
+      break;
+    default:
+      {
+        ssize_t n = (fd_cwd == AT_FDCWD
+                     ? getxattr (".", "system.posix_acl_access", NULL, 0)
+                     : fgetxattr (fd_cwd, "system.posix_acl_access",
+                                  NULL, 0));
+        verdict = (n < 0 && (errno == ENOTSUP || errno == EOPNOTSUPP)
+                   ? MODE_TRUSTED : MODE_ACLS);
+      }
+      break;
+    }
+
+  pthread_mutex_lock (&c->cred_lock);
+  if (c->n_dev_verdicts < DEV_VERDICTS_MAX)
+    {
+      c->dev_verdict[c->n_dev_verdicts].dev = dev;
+      c->dev_verdict[c->n_dev_verdicts++].verdict = verdict;
+    }
+  pthread_mutex_unlock (&c->cred_lock);
+  return verdict;
+#else
+  (void) c;
+  (void) fd_cwd;
+  (void) dev;
+  return MODE_UNTRUSTED;
+#endif
+}
+
+/* Return true if the directory entries of FD, an open directory on
+   the device DEV, give the inode numbers of the non-directories in it,
+   and those are all on DEV.  Union file systems such as overlayfs
+   merge directories from other file systems, and give neither; a FUSE
+   file system can give anything.  Ask statfs once for each device,
+   keeping the answer in C.  */
+static bool
+dirents_trusted (struct rm_caches *c, int fd, dev_t dev)
 {
-  return (0 <= st->st_size);
+#ifdef __linux__
+  struct statfs sfs;
+  bool trusted;
+  size_t i;
+
+  pthread_mutex_lock (&c->cred_lock);
+  for (i = 0; i < c->n_dirent_verdicts; i++)
+    if (c->dirent_verdict[i].dev == dev)
+      {
+        trusted = c->dirent_verdict[i].trusted;
+        pthread_mutex_unlock (&c->cred_lock);
+        return trusted;
+      }
+  pthread_mutex_unlock (&c->cred_lock);
+
+  if (fstatfs (fd, &sfs) != 0)
+    return false;
+  switch (sfs.f_type)
+    {
+    case 0x794C7630:		/* overlayfs */
+    case 0x61756673:		/* aufs */
+    case 0x65735546:		/* FUSE */
+      trusted = false;
+      break;
+    default:
+      trusted = true;
+      break;
+    }
+
+  pthread_mutex_lock (&c->cred_lock);
+  if (c->n_dirent_verdicts < DEV_VERDICTS_MAX)
+    {
+      c->dirent_verdict[c->n_dirent_verdicts].dev = dev;
+      c->dirent_verdict[c->n_dirent_verdicts++].trusted = trusted;
+    }
+  pthread_mutex_unlock (&c->cred_lock);
+  return trusted;
+#else
+  (void) c;
+  (void) fd;
+  (void) dev;
+  return false;
+#endif
 }
 
 /* Return 1 if FILE is an unwritable non-symlink,
    0 if it is writable or some other type of file,
    -1 and set errno if there is some problem in determining the answer.
    Use FULL_NAME only if necessary.
-   Set *BUF to the file status.
+   Cache the file status in *BUF, and what else is found out in C.
    This is to avoid calling euidaccess when FILE is a symlink.  */
 static int
-write_protected_non_symlink (int fd_cwd,
+write_protected_non_symlink (struct rm_caches *c, int fd_cwd,
                              char const *file,
                              char const *full_name,
-                             struct stat *buf)
+                             struct stat_cache *buf)
 {
   if (can_write_any_file ())
     return 0;
-  if (cache_fstatat (fd_cwd, file, buf, AT_SYMLINK_NOFOLLOW) != 0)
+  if (cache_fstatat (fd_cwd, file, buf, SC_TYPE) != 0)
     return -1;
-  if (S_ISLNK (buf->st_mode))
+  if (S_ISLNK (buf->st.st_mode))
     return 0;
   /* Here, we know FILE is not a symbolic link.  */
 
+  /* Calling faccessat for every file would double the number of
+     system calls rm makes, so decide from the permission bits where
+     the file system lets them: entirely if it has no ACLs, and
+     otherwise where an ACL can't change the answer.  Leave the rest,
+     and whatever is on a remote or FUSE file system, to faccessat.  */
+  if (cache_fstatat (fd_cwd, file, buf, SC_MODE | SC_UID | SC_GID) == 0)
+    {
+      enum mode_verdict verdict = mode_verdict_of (c, fd_cwd,
+                                                   buf->st.st_dev);
+      if (verdict != MODE_UNTRUSTED)
+        {
+          pthread_mutex_lock (&c->cred_lock);
+          know_cred (c);
+          int by_mode = write_protected_by_mode (c, &buf->st,
+                                                 verdict == MODE_ACLS);
+          pthread_mutex_unlock (&c->cred_lock);
+          if (0 <= by_mode)
+            return by_mode;
+        }
+    }
+
   /* In order to be reentrant -- i.e., to avoid changing the working
      directory, and at the same time to be able to deal with alternate
      access control mechanisms (ACLs, xattr-style attributes) and
@@ -172,6 +600,7 @@ write_protected_non_symlink (int fd_cwd,
        native or /proc/self/fd allows us to skip a chdir.  */
     if (!openat_needs_fchdir ())
       {
+        stats_count (buf->stats, buf->site, STATS_FACCESSAT);
         if (faccessat (fd_cwd, file, W_OK, AT_EACCESS) == 0)
           return 0;
 
@@ -182,7 +611,16 @@ write_protected_non_symlink (int fd_cwd,
     size_t file_name_len = strlen (full_name);
 
     if (MIN (PATH_MAX, 8192) <= file_name_len)
-      return ! euidaccess_stat (buf, W_OK);
+      {
+        if (cache_fstatat (fd_cwd, file, buf, SC_MODE | SC_UID | SC_GID) != 0)
+          return -1;
+        pthread_mutex_lock (&c->cred_lock);
+        know_cred (c);
+        bool writable = euidaccess_stat_as (&buf->st, W_OK, &c->cred.id);
+        pthread_mutex_unlock (&c->cred_lock);
+        return ! writable;
+      }
+    stats_count (buf->stats, buf->site, STATS_FACCESSAT);
     if (euidaccess (full_name, W_OK) == 0)
       return 0;
     if (errno == EACCES)
@@ -234,149 +672,481 @@ enum warn_status
   WARN_NOT_FOUND = (RM_OK + RM_USER_DECLINED + RM_ERROR)
 };
 
-static struct warnings_entry *
-warnings_table_lookup (Hash_table const *table, struct stat const *st_key)
+/* The buffers of quote are shared by every thread, so messages are
+   formatted with this lock held, and MESSAGE_ERRNUM is set meanwhile.  */
+static pthread_mutex_t message_lock = PTHREAD_MUTEX_INITIALIZER;
+static int message_errnum;
+
+/* Lock message_lock to format a message about the error ERRNUM.  */
+void
+lock_message (int errnum)
+{
+  pthread_mutex_lock (&message_lock);
+  message_errnum = errnum;
+}
+
+/* Unlock what lock_message locked, and report MESSAGE through the
+   error callback of X, with the errno value given to lock_message.  */
+void
+report_error (struct rm_options const *x, char *message)
+{
+  int errnum = message_errnum;
+  pthread_mutex_unlock (&message_lock);
+
+  struct rmfd const *c = x->context;
+  if (c->callbacks.error)
+    c->callbacks.error (c->data, errnum, message);
+  free (message);
+}
+
+/* Unlock what lock_message locked, and ask QUESTION, of kind KIND,
+   through the ask callback of X.  Return true if the answer is yes.  */
+bool
+ask_question (struct rm_options const *x, enum rmfd_question kind,
+              char *question)
+{
+  pthread_mutex_unlock (&message_lock);
+
+  struct rmfd const *c = x->context;
+  xtime_t start = trace_start (c->trace);
+  bool yes = c->callbacks.ask && c->callbacks.ask (c->data, kind, question);
+  trace_span (c->trace, TRACE_PROMPT, "prompt", start);
+  free (question);
+  return yes;
+}
+
+/* What the pre-scan found for an entry of a directory it read: its
+   warnings entry, or NULL if it is not protected.  */
+struct scanned_entry
+{
+  dev_t dir_dev;
+  ino_t dir_ino;
+  /* The device and inode number of the entry itself, if fts statted
+     it, as it does every directory.  */
+  dev_t dev;
+  ino_t ino;
+  struct warnings_entry *entry;
+  bool via_symlink;
+  char name[1];
+};
+
+/* A directory the pre-scan read, and its times when it did.  */
+struct scanned_dir
+{
+  struct timespec mtime;
+  struct timespec ctime;
+};
+
+/* The results of the pre-scan that the removal pass can reuse, for as
+   long as the directories they came from are unchanged.  */
+struct scan_snapshot
+{
+  /* The scanned_dirs, by device and inode number.  Its arena also
+     holds the scanned_entrys.  */
+  struct dev_ino_table *dirs;
+  Hash_table *entries;
+  /* When the pre-scan started.  A directory changed since then may
+     still have the same times, if they are coarse, so it is left out.  */
+  time_t start;
+};
+
+static size_t
+scanned_entry_hash (void const *x, size_t table_size)
+{
+  struct scanned_entry const *e = x;
+  return (hash_pjw (e->name, table_size) ^ e->dir_ino) % table_size;
+}
+
+static bool
+scanned_entry_comparator (void const *x, void const *y)
+{
+  struct scanned_entry const *a = x;
+  struct scanned_entry const *b = y;
+  return (a->dir_ino == b->dir_ino && a->dir_dev == b->dir_dev
+          && STREQ (a->name, b->name));
+}
+
+static struct scan_snapshot *
+snapshot_create (void)
 {
-  struct warnings_entry we;
-  we.dev = st_key->st_dev;
-  we.ino = st_key->st_ino;
-  return hash_lookup (table, &we);
+  struct scan_snapshot *snap = xmalloc (sizeof *snap);
+  snap->dirs = dev_ino_table_create ();
+  snap->entries = hash_initialize (1021, NULL, scanned_entry_hash,
+                                   scanned_entry_comparator, NULL);
+  if (! snap->entries)
+    xalloc_die ();
+  snap->start = time (NULL);
+  return snap;
 }
 
+/* Free SNAP, once rm is done with it.  */
+void
+scan_snapshot_free (struct scan_snapshot *snap)
+{
+  if (! snap)
+    return;
+  dev_ino_table_free (snap->dirs);
+  hash_free (snap->entries);
+  free (snap);
+}
+
+/* Record that the pre-scan is reading the directory ENT.  */
 static void
-issue_warning (char const *format, ...)
+snapshot_add_dir (struct scan_snapshot *snap, FTSENT const *ent)
 {
-  static Ternary use_colors = T_UNKNOWN;
+  struct stat const *st = ent->fts_statp;
+  struct scanned_dir *dir;
+
+  if (! (st->st_mtime < snap->start && st->st_ctime < snap->start))
+    return;
+  dir = dev_ino_table_alloc (snap->dirs, sizeof *dir);
+  dir->mtime = get_stat_mtime (st);
+  dir->ctime = get_stat_ctime (st);
+  dev_ino_table_insert (snap->dirs, st->st_dev, st->st_ino, dir);
+}
 
-  va_list args;
+/* Record that ENT, under a directory passed to snapshot_add_dir, was
+   looked up in the warnings table and found as ENTRY, or not found if
+   ENTRY is NULL.  */
+static void
+snapshot_add_entry (struct scan_snapshot *snap, FTSENT const *ent,
+                    struct warnings_entry *entry, bool via_symlink)
+{
+  struct stat const *dir_st = ent->fts_parent->fts_statp;
+  if (! dev_ino_table_lookup (snap->dirs, dir_st->st_dev, dir_st->st_ino))
+    return;
+
+  struct scanned_entry *e =
+    dev_ino_table_alloc (snap->dirs, sizeof *e + ent->fts_namelen);
+  e->dir_dev = dir_st->st_dev;
+  e->dir_ino = dir_st->st_ino;
+  e->dev = ent->fts_statp->st_dev;
+  e->ino = ent->fts_statp->st_ino;
+  e->entry = entry;
+  e->via_symlink = via_symlink;
+  strcpy (e->name, ent->fts_name);
+  if (! hash_insert (snap->entries, e))
+    xalloc_die ();
+}
 
-  if (use_colors == T_UNKNOWN)
-    use_colors = isatty (STDERR_FILENO) ? T_YES : T_NO;
+/* If the pre-scan looked up ENT, and its directory has not changed
+   since, set *FOUND and *VIA_SYMLINK to what it found and return
+   true.  A mount on a directory changes neither its parent nor the
+   entry for it, so a directory must also be the one the pre-scan
+   saw.  */
+static bool
+snapshot_lookup (struct scan_snapshot const *snap, FTSENT const *ent,
+                 struct warnings_entry **found, bool *via_symlink)
+{
+  if (ent->fts_level == FTS_ROOTLEVEL)
+    return false;
+
+  /* fts stats every directory, even with FTS_NOSTAT.  */
+  struct stat const *dir_st = ent->fts_parent->fts_statp;
+  struct scanned_dir const *dir =
+    dev_ino_table_lookup (snap->dirs, dir_st->st_dev, dir_st->st_ino);
+  if (! dir
+      || timespec_cmp (dir->mtime, get_stat_mtime (dir_st)) != 0
+      || timespec_cmp (dir->ctime, get_stat_ctime (dir_st)) != 0)
+    return false;
+
+  struct scanned_entry *key =
+    alloca (offsetof (struct scanned_entry, name) + ent->fts_namelen + 1);
+  key->dir_dev = dir_st->st_dev;
+  key->dir_ino = dir_st->st_ino;
+  strcpy (key->name, ent->fts_name);
+  struct scanned_entry const *e = hash_lookup (snap->entries, key);
+  if (! e)
+    return false;
+  if (ent->fts_info == FTS_D
+      && (e->ino != ent->fts_statp->st_ino
+          || e->dev != ent->fts_statp->st_dev))
+    return false;
+  *found = e->entry;
+  *via_symlink = e->via_symlink;
+  return true;
+}
 
-  if (use_colors == T_YES)
-    fprintf (stderr, _("%s: \033[01;31mWARNING:\033[0m "), program_name);
-  else
-    fprintf (stderr, _("%s: WARNING: "), program_name);
+/* Return true if ENT is a symbolic link to a directory, and set the
+   device and inode numbers in *ST to those of the directory.  Use
+   FD_CWD to resolve ENT->fts_accpath, count the calls as SC's, and
+   cache the target in C.  */
+static bool
+symlink_to_dir (struct rm_caches *c, FTSENT const *ent, int fd_cwd,
+                struct stat *st, struct stat_cache const *sc)
+{
+  char text[SYMLINK_CACHE_TEXT_MAX];
+  ssize_t len = -1;
+  dev_t dir_dev = 0;
+  ino_t dir_ino = 0;
+
+  /* A root has no parent directory to key a relative link on.  */
+  if (ent->fts_level != FTS_ROOTLEVEL)
+    len = readlinkat (fd_cwd, ent->fts_accpath, text, sizeof text);
+  if (len < 0 || len == sizeof text)
+    {
+      stats_count (sc->stats, sc->site, STATS_STAT);
+      return (fstatat (fd_cwd, ent->fts_accpath, st, 0) == 0
+              && S_ISDIR (st->st_mode));
+    }
+  text[len] = '\0';
+
+  if (text[0] != '/')
+    {
+      struct stat const *dir_st = ent->fts_parent->fts_statp;
+      dir_dev = dir_st->st_dev;
+      dir_ino = dir_st->st_ino;
+    }
 
-  va_start (args, format);
-  vfprintf (stderr, format, args);
-  va_end (args);
+  struct symlink_cache_slot *slot =
+    &c->symlink_cache[(hash_pjw (text, SYMLINK_CACHE_SIZE)
+                       ^ (dir_ino * 31 + dir_dev)) % SYMLINK_CACHE_SIZE];
+  bool hit;
+
+  pthread_mutex_lock (&c->symlink_cache_lock);
+  hit = (slot->text && slot->dir_ino == dir_ino && slot->dir_dev == dir_dev
+         && STREQ (slot->text, text));
+  if (hit)
+    {
+      st->st_dev = slot->dev;
+      st->st_ino = slot->ino;
+      st->st_mode = slot->is_dir ? S_IFDIR : 0;
+    }
+  pthread_mutex_unlock (&c->symlink_cache_lock);
+  if (hit)
+    return S_ISDIR (st->st_mode);
+
+  stats_count (sc->stats, sc->site, STATS_STAT);
+  bool is_dir = (fstatat (fd_cwd, ent->fts_accpath, st, 0) == 0
+                 && S_ISDIR (st->st_mode));
+
+  pthread_mutex_lock (&c->symlink_cache_lock);
+  free (slot->text);
+  slot->text = xstrdup (text);
+  slot->dir_dev = dir_dev;
+  slot->dir_ino = dir_ino;
+  slot->is_dir = is_dir;
+  if (is_dir)
+    {
+      slot->dev = st->st_dev;
+      slot->ino = st->st_ino;
+    }
+  pthread_mutex_unlock (&c->symlink_cache_lock);
+  return is_dir;
 }
 
 /* Look up the file referenced by ENT->fts_accpath.  Follow symlinks
-   if the target is a directory and we are in recursive mode.  Warn
-   and propmt the user if the object given by the device and inode
-   numbers are found in the warnings table.  Return WARN_NOT_FOUND if
-   the file was not in the warnings table and so the default prompt,
-   if any, should be given.  If the user allows removal, return
-   WARN_OK.  If they decline return WARN_USER_DECLINED.  If an error
-   occurs return WARN_ERROR.  Any value except WARN_NOT_FOUND has the
-   same value as its corresponding RM_status.
-
-   Use FD_CWD and CACHED_LSTAT for cache_fstatat calls.  */
+   if the target is a directory and we are in recursive mode.  If the
+   object given by the device and inode numbers is in the warnings
+   table, set *FOUND to its entry and *VIA_SYMLINK to whether it was
+   reached through ENT as a symlink, and return WARN_OK.  Return
+   WARN_NOT_FOUND if it is not in the table, and WARN_ERROR if an error
+   occurs.  Unless LAZY, look up the targets of symlinks only among the
+   entries already loaded, which is safe in several threads at once.
+
+   Use FD_CWD and CACHED_LSTAT for cache_fstatat calls.  If fts has
+   already statted ENT, use that instead.  */
 static enum warn_status
-warn (FTSENT const *ent, int fd_cwd, struct stat *cached_lstat,
-      struct rm_options const *x)
+find_warning (FTSENT const *ent, int fd_cwd, struct stat_cache *cached_lstat,
+              struct rm_options const *x, bool lazy,
+              struct warnings_entry **found, bool *via_symlink)
 {
-  if (-1 == cache_fstatat (fd_cwd, ent->fts_accpath, cached_lstat,
-                           AT_SYMLINK_NOFOLLOW))
-    return ignorable_missing (x, errno) ? WARN_NOT_FOUND : WARN_ERROR;
+  struct stat const *fts_st = ent->fts_statp;
+  bool is_link = false;
+
+  *via_symlink = false;
 
-  struct warnings_entry *found =
-    warnings_table_lookup (x->warnings_table, cached_lstat);
-  if (found)
+  if (ent->fts_info == FTS_NSOK)
     {
-      if (found->response == T_UNKNOWN)
+      /* fts took the type and inode number of ENT from its directory
+         entry.  Only a directory can be a mount point, so anything
+         else is on its parent's device, and if that pair is not in the
+         table there is no need to stat ENT.  Union file systems break
+         both assumptions, so stat ENT on those.  */
+      mode_t type = fts_st->st_mode & S_IFMT;
+      dev_t parent_dev = ent->fts_parent->fts_statp->st_dev;
+      if (type != 0 && type != S_IFDIR && fts_st->st_ino != 0
+          && ! warnings_table_may_contain (x->warnings_table,
+                                           parent_dev, fts_st->st_ino)
+          && dirents_trusted (x->context->caches, fd_cwd, parent_dev))
         {
-          issue_warning(_("you are about to remove %s; continue? "),
-                        quote (found->given_path));
-
-          found->response = yesno () ? T_YES : T_NO;
+          if (type != S_IFLNK || ! x->recursive)
+            return WARN_NOT_FOUND;
+          is_link = true;
         }
-      return (found->response == T_YES) ? WARN_OK : WARN_USER_DECLINED;
     }
+  else if (ent->fts_info != FTS_NS && ! cache_statted (cached_lstat))
+    cache_stat_set (cached_lstat, fts_st);
 
-  if (! S_ISLNK (cached_lstat->st_mode) || ! x->recursive)
-    return WARN_NOT_FOUND;
+  if (! is_link)
+    {
+      if (-1 == cache_fstatat (fd_cwd, ent->fts_accpath, cached_lstat,
+                               SC_TYPE | SC_INO))
+        return ignorable_missing (x, errno) ? WARN_NOT_FOUND : WARN_ERROR;
 
-  struct stat st;
-  if (-1 == stat (ent->fts_accpath, &st))
-    return ignorable_missing (x, errno) ? WARN_NOT_FOUND : WARN_ERROR;
+      *found = warnings_table_lookup (x->warnings_table, &cached_lstat->st);
+      if (*found)
+        return WARN_OK;
 
-  if (! S_ISDIR (st.st_mode))
-    return WARN_NOT_FOUND;
+      if (! S_ISLNK (cached_lstat->st.st_mode) || ! x->recursive)
+        return WARN_NOT_FOUND;
+    }
 
-  found = warnings_table_lookup (x->warnings_table, &st);
-  if (! found)
+  /* A symlink whose target can't be statted leads nowhere we need to
+     warn about.  */
+  struct stat st;
+  if (! symlink_to_dir (x->context->caches, ent, fd_cwd, &st, cached_lstat))
     return WARN_NOT_FOUND;
 
+  *via_symlink = true;
+  *found = (lazy
+            ? warnings_table_lookup_dir (x->warnings_table, ent->fts_path, &st)
+            : warnings_table_lookup (x->warnings_table, &st));
+  return *found ? WARN_OK : WARN_NOT_FOUND;
+}
+
+/* For a --warnings-policy other than WARNINGS_ASK in X, tell the
+   protected callback that removing FILENAME would remove GIVEN_PATH,
+   the protected file, and return the answer the policy gives, without
+   asking.  */
+static Ternary
+policy_response (char const *given_path, char const *filename,
+                 struct rm_options const *x)
+{
+  struct rmfd const *c = x->context;
+  if (c->callbacks.protected)
+    c->callbacks.protected (c->data, given_path, filename);
+  return x->warnings_policy == WARNINGS_DENY ? T_NO : T_YES;
+}
+
+/* Warn and prompt the user about removing FOUND, the entry that
+   find_warning found for FILENAME, unless they have already answered.
+   Return WARN_OK if the user allows removal, and WARN_USER_DECLINED
+   otherwise.  */
+static enum warn_status
+confirm_warning (struct warnings_entry *found, char const *filename,
+                 bool via_symlink, struct rm_options const *x)
+{
   if (found->response == T_UNKNOWN)
     {
-      issue_warning(_("you are about to recursively remove"
-                      " the contents of %s "),
-                    quote (found->given_path));
-      fprintf (stderr, _("through symbolic link %s; continue? "),
-               quote (ent->fts_path));
+      if (x->warnings_policy != WARNINGS_ASK)
+        found->response = policy_response (found->given_path, filename, x);
+      else
+        {
+          bool yes;
+          if (via_symlink)
+            yes = rm_ask (x, RMFD_ASK_WARNING,
+                          _("you are about to recursively remove"
+                            " the contents of %s through symbolic link %s;"
+                            " continue? "),
+                          quote_n (0, found->given_path),
+                          quote_n (1, filename));
+          else
+            yes = rm_ask (x, RMFD_ASK_WARNING,
+                          _("you are about to remove %s; continue? "),
+                          quote (found->given_path));
 
-      found->response = yesno () ? T_YES : T_NO;
+          found->response = yes ? T_YES : T_NO;
+        }
     }
 
   return (found->response == T_YES) ? WARN_OK : WARN_USER_DECLINED;
 }
 
-/* Prompt whether to remove FILENAME (ent->, if required via a combination of
-   the options specified by X and/or file attributes.  If the file may
-   be removed, return RM_OK.  If the user declines to remove the file,
-   return RM_USER_DECLINED.  If not ignoring missing files and we
-   cannot lstat FILENAME, then return RM_ERROR.
+/* Look up the file referenced by ENT->fts_accpath as find_warning
+   does.  Warn and propmt the user if it is found in the warnings
+   table.  Return WARN_NOT_FOUND if the file was not in the warnings
+   table and so the default prompt, if any, should be given.  If the
+   user allows removal, return WARN_OK.  If they decline return
+   WARN_USER_DECLINED.  If an error occurs return WARN_ERROR.  Any
+   value except WARN_NOT_FOUND has the same value as its corresponding
+   RM_status.
 
-   IS_DIR is true if ENT designates a directory, false otherwise.
+   If the pre-scan already looked up ENT, and its directory is unchanged,
+   reuse what it found rather than looking again.  The directory's times
+   would have changed if the name had been pointed at another file.
 
-   Depending on MODE, ask whether to `descend into' or to `remove' the
-   directory FILENAME.  MODE is ignored when FILENAME is not a directory.
-   Set *IS_EMPTY_P to T_YES if FILENAME is an empty directory, and it is
-   appropriate to try to remove it with rmdir (e.g. recursive mode).
-   Don't even try to set *IS_EMPTY_P when MODE == PA_REMOVE_DIR.  */
-static enum RM_status
-prompt (FTS const *fts, FTSENT const *ent, bool is_dir,
-        struct rm_options const *x, enum Prompt_action mode,
-        Ternary *is_empty_p)
+   Use FD_CWD and CACHED_LSTAT for cache_fstatat calls.  */
+static enum warn_status
+warn (FTSENT const *ent, int fd_cwd, struct stat_cache *cached_lstat,
+      struct rm_options const *x)
 {
-  int fd_cwd = fts->fts_cwd_fd;
-  char const *full_name = ent->fts_path;
-  char const *filename = ent->fts_accpath;
-  if (is_empty_p)
-    *is_empty_p = T_UNKNOWN;
+  struct warnings_entry *found;
+  bool via_symlink;
 
-  struct stat st;
-  struct stat *sbuf = &st;
-  cache_stat_init (sbuf);
-
-  if (x->warnings_table)
+  /* Only look among the entries already loaded, which is safe while
+     the pre-scan runs, and leave whatever is found for later.  */
+  if (x->defer_prompts)
     {
-      enum warn_status ws = warn (ent, fd_cwd, sbuf, x);
-      if (ws != WARN_NOT_FOUND)
-        return (enum RM_status) ws;
+      enum warn_status status = find_warning (ent, fd_cwd, cached_lstat, x,
+                                              false, &found, &via_symlink);
+      return status == WARN_OK ? WARN_USER_DECLINED : status;
     }
 
-  int dirent_type = is_dir ? DT_DIR : DT_UNKNOWN;
-  int write_protected = 0;
+  if (x->snapshot && snapshot_lookup (x->snapshot, ent, &found, &via_symlink))
+    return found ? confirm_warning (found, ent->fts_path, via_symlink, x)
+                 : WARN_NOT_FOUND;
 
-  /* When nonzero, this indicates that we failed to remove a child entry,
-     either because the user declined an interactive prompt, or due to
-     some other failure, like permissions.  */
-  if (ent->fts_number)
-    return RM_USER_DECLINED;
+  enum warn_status status = find_warning (ent, fd_cwd, cached_lstat, x, true,
+                                          &found, &via_symlink);
+  if (status != WARN_OK)
+    return status;
+  return confirm_warning (found, ent->fts_path, via_symlink, x);
+}
 
-  if (x->interactive == RMI_NEVER)
-    return RM_OK;
+/* The options that rm_fts has to test for each entry, as the bits of
+   the FEATURES its variants are specialized for.  rm picks the variant
+   once, so that, say, the loop of rm -rf tests none of the others.  */
+enum
+{
+  /* -i, or asking about write-protected files.  */
+  RMF_PROMPT = 1 << 0,
+  /* -w: the warnings table or PROTECT_MARKER.  */
+  RMF_WARNINGS = 1 << 1,
+  /* --one-file-system.  */
+  RMF_ONE_FILE_SYSTEM = 1 << 2,
+  /* The removed or progress callback, as with -v, --stats, a trace,
+     or --progress.  */
+  RMF_REPORT = 1 << 3,
+  RMF_ALL = (1 << 4) - 1
+};
+
+/* Return the FEATURES of rm_fts that X calls for.  */
+static int
+rm_fts_features (struct rm_options const *x)
+{
+  struct rmfd const *c = x->context;
+  /* -I and a stdin that is no tty leave ask_user nothing to do.  */
+  bool prompt = (x->interactive == RMI_ALWAYS
+                 || (x->interactive == RMI_SOMETIMES && x->stdin_tty
+                     && ! x->ignore_missing_files));
+  return ((prompt ? RMF_PROMPT : 0)
+          | (x->warnings_table || x->protect_markers ? RMF_WARNINGS : 0)
+          | (x->one_file_system ? RMF_ONE_FILE_SYSTEM : 0)
+          | (c->callbacks.removed || c->callbacks.progress || c->stats
+             || c->trace || (c->flags & RMFD_PROGRESS) ? RMF_REPORT : 0));
+}
+
+/* The part of prompt below for when X may ask about ENT, with the
+   status of ENT cached in *SBUF.  */
+static enum RM_status
+ask_user (FTS const *fts, FTSENT const *ent, bool is_dir,
+          struct rm_options const *x, enum Prompt_action mode,
+          Ternary *is_empty_p, struct stat_cache *sbuf)
+{
+  int fd_cwd = fts->fts_cwd_fd;
+  char const *full_name = ent->fts_path;
+  char const *filename = ent->fts_accpath;
+  int dirent_type = is_dir ? DT_DIR : DT_UNKNOWN;
+  int write_protected = 0;
 
   int wp_errno = 0;
   if (!x->ignore_missing_files
       && ((x->interactive == RMI_ALWAYS) || x->stdin_tty)
       && dirent_type != DT_LNK)
     {
-      write_protected = write_protected_non_symlink (fd_cwd, filename,
+      write_protected = write_protected_non_symlink (x->context->caches,
+                                                     fd_cwd, filename,
                                                      full_name, sbuf);
       wp_errno = errno;
     }
@@ -385,11 +1155,11 @@ prompt (FTS const *fts, FTSENT const *ent, bool is_dir,
     {
       if (0 <= write_protected && dirent_type == DT_UNKNOWN)
         {
-          if (cache_fstatat (fd_cwd, filename, sbuf, AT_SYMLINK_NOFOLLOW) == 0)
+          if (cache_fstatat (fd_cwd, filename, sbuf, SC_TYPE) == 0)
             {
-              if (S_ISLNK (sbuf->st_mode))
+              if (S_ISLNK (sbuf->st.st_mode))
                 dirent_type = DT_LNK;
-              else if (S_ISDIR (sbuf->st_mode))
+              else if (S_ISDIR (sbuf->st.st_mode))
                 dirent_type = DT_DIR;
               /* Otherwise it doesn't matter, so leave it DT_UNKNOWN.  */
             }
@@ -419,14 +1189,15 @@ prompt (FTS const *fts, FTSENT const *ent, bool is_dir,
             break;
           }
 
-      char const *quoted_name = quote (full_name);
-
       if (write_protected < 0)
         {
-          error (0, wp_errno, _("cannot remove %s"), quoted_name);
+          rm_error (x, wp_errno, _("cannot remove %s"), quote (full_name));
           return RM_ERROR;
         }
 
+      if (x->defer_prompts)
+        return RM_USER_DECLINED;
+
       bool is_empty;
       if (is_empty_p)
         {
@@ -437,68 +1208,114 @@ prompt (FTS const *fts, FTSENT const *ent, bool is_dir,
         is_empty = false;
 
       /* Issue the prompt.  */
+      bool yes;
       if (dirent_type == DT_DIR
           && mode == PA_DESCEND_INTO_DIR
           && !is_empty)
-        fprintf (stderr,
-                 (write_protected
-                  ? _("%s: descend into write-protected directory %s? ")
-                  : _("%s: descend into directory %s? ")),
-                 program_name, quoted_name);
+        yes = rm_ask (x, RMFD_ASK_REMOVE,
+                      (write_protected
+                       ? _("descend into write-protected directory %s? ")
+                       : _("descend into directory %s? ")),
+                      quote (full_name));
       else
         {
-          if (cache_fstatat (fd_cwd, filename, sbuf, AT_SYMLINK_NOFOLLOW) != 0)
+          if (cache_fstatat (fd_cwd, filename, sbuf, SC_TYPE | SC_SIZE) != 0)
             {
-              error (0, errno, _("cannot remove %s"), quoted_name);
+              rm_error (x, errno, _("cannot remove %s"), quote (full_name));
               return RM_ERROR;
             }
 
-          fprintf (stderr,
-                   (write_protected
-                    /* TRANSLATORS: You may find it more convenient to
-                       translate "%s: remove %s (write-protected) %s? "
-                       instead.  It should avoid grammatical problems
-                       with the output of file_type.  */
-                    ? _("%s: remove write-protected %s %s? ")
-                    : _("%s: remove %s %s? ")),
-                   program_name, file_type (sbuf), quoted_name);
+          yes = rm_ask (x, RMFD_ASK_REMOVE,
+                        (write_protected
+                         /* TRANSLATORS: You may find it more convenient to
+                            translate "remove %s (write-protected) %s? "
+                            instead.  It should avoid grammatical problems
+                            with the output of file_type.  */
+                         ? _("remove write-protected %s %s? ")
+                         : _("remove %s %s? ")),
+                        file_type (&sbuf->st), quote (full_name));
         }
 
-      if (!yesno ())
+      if (!yes)
         return RM_USER_DECLINED;
     }
   return RM_OK;
 }
 
-/* Return true if FILENAME is a directory (and not a symlink to a directory).
-   Otherwise, including the case in which lstat fails, return false.
-   *ST is FILENAME's tstatus.
-   Do not modify errno.  */
-static inline bool
-is_dir_lstat (int fd_cwd, char const *filename, struct stat *st)
-{
-  int saved_errno = errno;
-  bool is_dir =
-    (cache_fstatat (fd_cwd, filename, st, AT_SYMLINK_NOFOLLOW) == 0
-     && S_ISDIR (st->st_mode));
-  errno = saved_errno;
-  return is_dir;
-}
+/* Prompt whether to remove FILENAME (ent->, if required via a combination of
+   the options specified by X and/or file attributes.  If the file may
+   be removed, return RM_OK.  If the user declines to remove the file,
+   return RM_USER_DECLINED.  If not ignoring missing files and we
+   cannot lstat FILENAME, then return RM_ERROR.
 
-/* Return true if FILENAME is a non-directory.
-   Otherwise, including the case in which lstat fails, return false.
-   *ST is FILENAME's tstatus.
-   Do not modify errno.  */
-static inline bool
-is_nondir_lstat (int fd_cwd, char const *filename, struct stat *st)
-{
-  int saved_errno = errno;
-  bool is_non_dir =
-    (cache_fstatat (fd_cwd, filename, st, AT_SYMLINK_NOFOLLOW) == 0
-     && !S_ISDIR (st->st_mode));
-  errno = saved_errno;
-  return is_non_dir;
-}
+   IS_DIR is true if ENT designates a directory, false otherwise.
+
+   Depending on MODE, ask whether to `descend into' or to `remove' the
+   directory FILENAME.  MODE is ignored when FILENAME is not a directory.
+   Set *IS_EMPTY_P to T_YES if FILENAME is an empty directory, and it is
+   appropriate to try to remove it with rmdir (e.g. recursive mode).
+   Don't even try to set *IS_EMPTY_P when MODE == PA_REMOVE_DIR.
+   Test only the options among FEATURES.  */
+ATTRIBUTE_ALWAYS_INLINE static inline enum RM_status
+prompt (FTS const *fts, FTSENT const *ent, bool is_dir,
+        struct rm_options const *x, enum Prompt_action mode,
+        Ternary *is_empty_p, int features)
+{
+  if (is_empty_p)
+    *is_empty_p = T_UNKNOWN;
+
+  struct stat_cache st;
+  cache_stat_init (&st, x->context->stats, STATS_SITE_WARN);
+
+  if ((features & RMF_WARNINGS) && x->warnings_table)
+    {
+      enum warn_status ws = warn (ent, fts->fts_cwd_fd, &st, x);
+      if (ws != WARN_NOT_FOUND)
+        return (enum RM_status) ws;
+    }
+
+  /* When nonzero, this indicates that we failed to remove a child entry,
+     either because the user declined an interactive prompt, or due to
+     some other failure, like permissions.  */
+  if (ent->fts_number)
+    return RM_USER_DECLINED;
+
+  if (! (features & RMF_PROMPT))
+    return RM_OK;
+
+  st.site = STATS_SITE_PROMPT;
+  return ask_user (fts, ent, is_dir, x, mode, is_empty_p, &st);
+}
+
+/* Return true if FILENAME is a directory (and not a symlink to a directory).
+   Otherwise, including the case in which lstat fails, return false.
+   *ST caches FILENAME's status.
+   Do not modify errno.  */
+static inline bool
+is_dir_lstat (int fd_cwd, char const *filename, struct stat_cache *st)
+{
+  int saved_errno = errno;
+  bool is_dir =
+    (cache_fstatat (fd_cwd, filename, st, SC_TYPE) == 0
+     && S_ISDIR (st->st.st_mode));
+  errno = saved_errno;
+  return is_dir;
+}
+
+/* Return true if FILENAME is a non-directory.
+   Otherwise, including the case in which lstat fails, return false.
+   *ST caches FILENAME's status.
+   Do not modify errno.  */
+static inline bool
+is_nondir_lstat (int fd_cwd, char const *filename, struct stat_cache *st)
+{
+  int saved_errno = errno;
+  bool is_non_dir =
+    (cache_fstatat (fd_cwd, filename, st, SC_TYPE) == 0
+     && !S_ISDIR (st->st.st_mode));
+  errno = saved_errno;
+  return is_non_dir;
+}
 
 /* Tell fts not to traverse into the hierarchy at ENT.  */
 static void
@@ -524,24 +1341,92 @@ mark_ancestor_dirs (FTSENT *ent)
     }
 }
 
-/* Remove the file system object specified by ENT.  IS_DIR specifies
-   whether it is expected to be a directory or non-directory.
-   Return RM_OK upon success, else RM_ERROR.  */
+/* What the fts_pointer of a directory under an operand says about
+   whether it holds PROTECT_MARKER: not looked yet (NULL), not among
+   the entries read so far, or there and the user answered.  */
+static char marker_absent;
+static char marker_allowed;
+static char marker_declined;
+
+/* Return true if ENT is named PROTECT_MARKER.  */
+static inline bool
+is_protect_marker (FTSENT const *ent)
+{
+  return (ent->fts_namelen == sizeof PROTECT_MARKER - 1
+          && memcmp (ent->fts_name, PROTECT_MARKER,
+                     sizeof PROTECT_MARKER - 1) == 0);
+}
+
+/* If ENT is the first entry of its directory that rm_fts gets, and
+   PROTECT_MARKER is among the entries, warn and prompt the user about
+   removing the directory.  Return RM_USER_DECLINED, having arranged
+   to skip the rest of the directory, if they decline or already
+   have, and RM_OK otherwise.
+
+   fts reads all the entries of a directory before it hands out the
+   first one, and links them from there on through fts_link, so no
+   system call is needed to look.  But it may read a huge directory in
+   batches, so the marker may also turn up later as ENT itself.  */
 static enum RM_status
-excise (FTS *fts, FTSENT *ent, struct rm_options const *x, bool is_dir)
+check_protect_marker (FTS *fts, FTSENT *ent, struct rm_options const *x)
 {
-  int flag = is_dir ? AT_REMOVEDIR : 0;
-  if (unlinkat (fts->fts_cwd_fd, ent->fts_accpath, flag) == 0)
+  FTSENT *dir = ent->fts_parent;
+  FTSENT *p;
+
+  if (dir->fts_pointer == &marker_allowed)
+    return RM_OK;
+  if (dir->fts_pointer != &marker_declined)
     {
-      if (x->verbose)
+      bool found = false;
+      if (dir->fts_pointer == NULL)
+        for (p = ent; p && ! found; p = p->fts_link)
+          found = is_protect_marker (p);
+      else
+        found = is_protect_marker (ent);
+      if (! found)
+        {
+          dir->fts_pointer = &marker_absent;
+          return RM_OK;
+        }
+
+      char *dir_name = xstrndup (ent->fts_path, dir->fts_pathlen);
+      bool allowed;
+      if (x->defer_prompts)
+        allowed = false;
+      else if (x->warnings_policy != WARNINGS_ASK)
         {
-          printf ((is_dir
-                   ? _("removed directory: %s\n")
-                   : _("removed %s\n")), quote (ent->fts_path));
+          char *marker = xconcatenated_filename (dir_name, PROTECT_MARKER,
+                                                 NULL);
+          allowed = policy_response (marker, dir_name, x) == T_YES;
+          free (marker);
         }
-      return RM_OK;
+      else
+        allowed = rm_ask (x, RMFD_ASK_WARNING,
+                          _("you are about to remove protected directory %s;"
+                            " continue? "), quote (dir_name));
+      free (dir_name);
+      dir->fts_pointer = allowed ? &marker_allowed : &marker_declined;
+      if (dir->fts_pointer == &marker_allowed)
+        return RM_OK;
+
+      for (p = ent->fts_link; p; p = p->fts_link)
+        fts_set (fts, p, FTS_SKIP);
     }
 
+  mark_ancestor_dirs (ent);
+  if (ent->fts_info == FTS_D)
+    fts_skip_tree (fts, ent);
+  return RM_USER_DECLINED;
+}
+
+/* Report the failure of excise to remove ENT, with errno set, unless
+   X ignores it.  Return RM_OK if it does, else RM_ERROR.  */
+static enum RM_status
+excise_failed (FTS *fts, FTSENT *ent, struct rm_options const *x)
+{
+  struct stats *stats = x->context->stats;
+  stats_count (stats, STATS_SITE_REMOVE, STATS_UNLINKAT);
+
   /* The unlinkat from kernels like linux-2.6.32 reports EROFS even for
      nonexistent files.  When the file is indeed missing, map that to ENOENT,
      so that rm -f ignores it, as required.  Even without -f, this is useful
@@ -549,6 +1434,7 @@ excise (FTS *fts, FTSENT *ent, struct rm_options const *x, bool is_dir)
   if (errno == EROFS)
     {
       struct stat st;
+      stats_count (stats, STATS_SITE_REMOVE, STATS_FSTATAT);
       if ( ! (lstatat (fts->fts_cwd_fd, ent->fts_accpath, &st)
                        && errno == ENOENT))
         errno = EROFS;
@@ -563,20 +1449,203 @@ excise (FTS *fts, FTSENT *ent, struct rm_options const *x, bool is_dir)
      Use the earlier, more descriptive errno value.  */
   if (ent->fts_info == FTS_DNR)
     errno = ent->fts_errno;
-  error (0, errno, _("cannot remove %s"), quote (ent->fts_path));
+  rm_error (x, errno, _("cannot remove %s"), quote (ent->fts_path));
   mark_ancestor_dirs (ent);
   return RM_ERROR;
 }
 
+/* Note that ENT is the directory most recently entered, for
+   rmfd_get_progress.  This is once per directory, so a lock will do.  */
+static void
+enter_dir (struct rmfd *c, FTSENT const *ent)
+{
+  size_t size = ent->fts_pathlen + 1;
+
+  pthread_mutex_lock (&c->lock);
+  if (c->dir_alloc < size)
+    {
+      free (c->dir);
+      c->dir = xmalloc (size);
+      c->dir_alloc = size;
+    }
+  memcpy (c->dir, ent->fts_path, size);
+  pthread_mutex_unlock (&c->lock);
+}
+
+/* Call the snapshot callback of C, which rmfd_request_snapshot asked
+   for, unless another thread is already on its way to.  */
+static void
+send_snapshot (struct rmfd *c)
+{
+  pthread_mutex_lock (&c->lock);
+  bool wanted = c->snapshot_wanted;
+  c->snapshot_wanted = 0;
+  pthread_mutex_unlock (&c->lock);
+
+  if (wanted && c->callbacks.snapshot)
+    c->callbacks.snapshot (c->data);
+}
+
+/* Return the size of ENT, a file that is not a directory, statting it
+   if fts did not, or 0 if it can't be statted.  */
+static off_t
+file_size (FTS *fts, FTSENT const *ent, struct rm_options const *x)
+{
+  struct stat st;
+
+  if (ent->fts_info != FTS_NSOK)
+    return ent->fts_statp->st_size;
+  stats_count (x->context->stats, STATS_SITE_REMOVE, STATS_FSTATAT);
+  return (fstatat (fts->fts_cwd_fd, ent->fts_accpath, &st,
+                   AT_SYMLINK_NOFOLLOW) == 0
+          ? st.st_size : 0);
+}
+
+/* Remove the file system object specified by ENT.  IS_DIR specifies
+   whether it is expected to be a directory or non-directory.
+   Return RM_OK upon success, else RM_ERROR.  Call the removed and
+   progress callbacks, and count and trace the removal, only if
+   FEATURES has RMF_REPORT.  */
+ATTRIBUTE_ALWAYS_INLINE static inline enum RM_status
+excise (FTS *fts, FTSENT *ent, struct rm_options const *x, bool is_dir,
+        int features)
+{
+  struct rmfd *c = x->context;
+  int flag = is_dir ? AT_REMOVEDIR : 0;
+  off_t size = 0;
+  xtime_t start = 0;
+  if (features & RMF_REPORT)
+    {
+      if ((c->flags & RMFD_PROGRESS) && ! is_dir)
+        size = file_size (fts, ent, x);
+      start = trace_start (c->trace);
+    }
+  if (unlinkat (fts->fts_cwd_fd, ent->fts_accpath, flag) != 0)
+    return excise_failed (fts, ent, x);
+
+  /* Kept however rm is run, for rmfd_get_progress: a relaxed atomic
+     add costs next to nothing beside the unlinkat.  */
+  uintmax_t n_removed = stats_add (&c->n_removed, 1) + 1;
+
+  if (features & RMF_REPORT)
+    {
+      trace_call (c->trace, "unlinkat", ent->fts_path, start);
+      if (size)
+        stats_add (&c->bytes_removed, size);
+      if (c->stats)
+        {
+          stats_add (&c->stats->calls[STATS_SITE_REMOVE][STATS_UNLINKAT], 1);
+          stats_add (&c->stats->removed, 1);
+        }
+      if (c->callbacks.removed)
+        c->callbacks.removed (c->data, ent->fts_path, is_dir);
+      if (c->callbacks.progress)
+        c->callbacks.progress (c->data, n_removed);
+    }
+  return RM_OK;
+}
+
+/* Return true if ENT, a directory below a command line argument, is
+   a mount point that FTS_XDEV doesn't keep fts out of, since it has
+   the same device number as the argument, like a bind mount.  */
+static bool
+same_dev_mount_point (FTS const *fts, FTSENT const *ent,
+                      struct rm_options const *x)
+{
+  return (x->one_file_system && x->mount_table
+          && FTS_ROOTLEVEL < ent->fts_level
+          && ent->fts_statp->st_dev == fts->fts_dev
+          && mount_table_is_mount_point (x->mount_table, ent->fts_path,
+                                         ent->fts_statp));
+}
+
+/* Return true if ENT, a command line argument that is a directory,
+   is a mount point.  Without a list of mount points, look for one on
+   a different device from its parent.  */
+static bool
+mount_point_arg (FTS const *fts, FTSENT const *ent,
+                 struct rm_options const *x)
+{
+  if (x->mount_table)
+    return mount_table_is_mount_point (x->mount_table, ent->fts_path,
+                                       ent->fts_statp);
+
+  char *parent = xconcatenated_filename (ent->fts_accpath, "..", NULL);
+  struct stat st;
+  stats_count (x->context->stats, STATS_SITE_REMOVE, STATS_FSTATAT);
+  bool mount_point = (fstatat (fts->fts_cwd_fd, parent, &st,
+                               AT_SYMLINK_NOFOLLOW) == 0
+                      && st.st_dev != ent->fts_statp->st_dev);
+  free (parent);
+  return mount_point;
+}
+
+/* Perform the checks of rm_fts that can apply only for ENT, a
+   command-line argument that is a directory.  Return RM_ERROR,
+   having skipped ENT, if it is not to be removed, else RM_OK.  */
+static enum RM_status
+check_root_arg (FTS *fts, FTSENT *ent, struct rm_options const *x)
+{
+  if (strip_trailing_slashes (ent->fts_path))
+    ent->fts_pathlen = strlen (ent->fts_path);
+
+  /* If the basename of a command line argument is "." or "..",
+     diagnose it and do nothing more with that argument.  */
+  if (dot_or_dotdot (last_component (ent->fts_accpath)))
+    {
+      rm_error (x, 0, _("cannot remove directory: %s"),
+                quote (ent->fts_path));
+      fts_skip_tree (fts, ent);
+      return RM_ERROR;
+    }
+
+  /* If a command line argument resolves to "/" (and --preserve-root
+     is in effect -- default) diagnose and skip it.  */
+  if (ROOT_DEV_INO_CHECK (x->root_dev_ino, ent->fts_statp))
+    {
+      /* As ROOT_DEV_INO_WARN, but through the callbacks.  */
+      if (STREQ (ent->fts_path, "/"))
+        rm_error (x, 0, _("it is dangerous to operate recursively"
+                          " on %s"), quote (ent->fts_path));
+      else
+        rm_error (x, 0, _("it is dangerous to operate recursively"
+                          " on %s (same as %s)"),
+                  quote_n (0, ent->fts_path), quote_n (1, "/"));
+      rm_error (x, 0, _("use --no-preserve-root to override this"
+                        " failsafe"));
+      fts_skip_tree (fts, ent);
+      return RM_ERROR;
+    }
+
+  /* With --preserve-root=all, the same goes for a mount point.  */
+  if (x->preserve_all_root && mount_point_arg (fts, ent, x))
+    {
+      rm_error (x, 0, _("skipping %s, since it's a mount point"),
+                quote (ent->fts_path));
+      rm_error (x, 0, _("and --preserve-root=all is in effect"));
+      fts_skip_tree (fts, ent);
+      return RM_ERROR;
+    }
+
+  return RM_OK;
+}
+
 /* This function is called once for every file system object that fts
    encounters.  fts performs a depth-first traversal.
    A directory is usually processed twice, first with fts_info == FTS_D,
    and later, after all of its entries have been processed, with FTS_DP.
    Return RM_ERROR upon error, RM_USER_DECLINED for a negative response
-   to an interactive prompt, and otherwise, RM_OK.  */
-static enum RM_status
-rm_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
+   to an interactive prompt, and otherwise, RM_OK.
+   FEATURES are those of rm_fts_features (X).  */
+ATTRIBUTE_ALWAYS_INLINE static inline enum RM_status
+rm_fts (FTS *fts, FTSENT *ent, struct rm_options const *x, int features)
 {
+  if ((features & RMF_WARNINGS) && x->protect_markers
+      && FTS_ROOTLEVEL < ent->fts_level
+      && ent->fts_info != FTS_DP
+      && check_protect_marker (fts, ent, x) != RM_OK)
+    return RM_USER_DECLINED;
+
   switch (ent->fts_info)
     {
     case FTS_D:			/* preorder directory */
@@ -584,48 +1653,40 @@ rm_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
         {
           /* This is the first (pre-order) encounter with a directory.
              Not recursive, so arrange to skip contents.  */
-          error (0, EISDIR, _("cannot remove %s"), quote (ent->fts_path));
+          rm_error (x, EISDIR, _("cannot remove %s"), quote (ent->fts_path));
           mark_ancestor_dirs (ent);
           fts_skip_tree (fts, ent);
           return RM_ERROR;
         }
 
       /* Perform checks that can apply only for command-line arguments.  */
-      if (ent->fts_level == FTS_ROOTLEVEL)
+      if (ent->fts_level == FTS_ROOTLEVEL
+          && check_root_arg (fts, ent, x) != RM_OK)
+        return RM_ERROR;
+
+      /* fts' FTS_XDEV only keeps rm off other devices, so with
+         --one-file-system skip a bind mount of the same one here.  */
+      if ((features & RMF_ONE_FILE_SYSTEM)
+          && same_dev_mount_point (fts, ent, x))
         {
-          if (strip_trailing_slashes (ent->fts_path))
-            ent->fts_pathlen = strlen (ent->fts_path);
-
-          /* If the basename of a command line argument is "." or "..",
-             diagnose it and do nothing more with that argument.  */
-          if (dot_or_dotdot (last_component (ent->fts_accpath)))
-            {
-              error (0, 0, _("cannot remove directory: %s"),
-                     quote (ent->fts_path));
-              fts_skip_tree (fts, ent);
-              return RM_ERROR;
-            }
-
-          /* If a command line argument resolves to "/" (and --preserve-root
-             is in effect -- default) diagnose and skip it.  */
-          if (ROOT_DEV_INO_CHECK (x->root_dev_ino, ent->fts_statp))
-            {
-              ROOT_DEV_INO_WARN (ent->fts_path);
-              fts_skip_tree (fts, ent);
-              return RM_ERROR;
-            }
+          mark_ancestor_dirs (ent);
+          rm_error (x, 0, _("skipping %s, since it's a mount point"),
+                    quote (ent->fts_path));
+          fts_skip_tree (fts, ent);
+          return RM_ERROR;
         }
 
       {
         Ternary is_empty_directory;
         enum RM_status s = prompt (fts, ent, true /*is_dir*/, x,
-                                   PA_DESCEND_INTO_DIR, &is_empty_directory);
+                                   PA_DESCEND_INTO_DIR, &is_empty_directory,
+                                   features);
 
         if (s == RM_OK && is_empty_directory == T_YES)
           {
             /* When we know (from prompt when in interactive mode)
                that this is an empty directory, don't prompt twice.  */
-            s = excise (fts, ent, x, true);
+            s = excise (fts, ent, x, true, features);
             fts_skip_tree (fts, ent);
           }
 
@@ -634,6 +1695,16 @@ rm_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
             mark_ancestor_dirs (ent);
             fts_skip_tree (fts, ent);
           }
+        else if (is_empty_directory != T_YES)
+          {
+            enter_dir (x->context, ent);
+            if (features & RMF_REPORT)
+              {
+                stats_count (x->context->stats, STATS_SITE_REMOVE,
+                             STATS_READDIR);
+                trace_dir_enter (x->context->trace, ent->fts_level);
+              }
+          }
 
         return s;
       }
@@ -650,53 +1721,319 @@ rm_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
         /* With --one-file-system, do not attempt to remove a mount point.
            fts' FTS_XDEV ensures that we don't process any entries under
            the mount point.  */
-        if (ent->fts_info == FTS_DP
-            && x->one_file_system
+        if ((features & RMF_ONE_FILE_SYSTEM)
+            && ent->fts_info == FTS_DP
             && FTS_ROOTLEVEL < ent->fts_level
             && ent->fts_statp->st_dev != fts->fts_dev)
           {
             mark_ancestor_dirs (ent);
-            error (0, 0, _("skipping %s, since it's on a different device"),
-                   quote (ent->fts_path));
+            rm_error (x, 0, _("skipping %s, since it's on a different"
+                              " device"), quote (ent->fts_path));
             return RM_ERROR;
           }
 
         bool is_dir = ent->fts_info == FTS_DP || ent->fts_info == FTS_DNR;
-        enum RM_status s = prompt (fts, ent, is_dir, x, PA_REMOVE_DIR, NULL);
-        if (s != RM_OK)
-          return s;
-        return excise (fts, ent, x, is_dir);
+        enum RM_status s = prompt (fts, ent, is_dir, x, PA_REMOVE_DIR, NULL,
+                                   features);
+        if (s == RM_OK)
+          s = excise (fts, ent, x, is_dir, features);
+        if ((features & RMF_REPORT) && ent->fts_info == FTS_DP)
+          trace_dir_leave (x->context->trace, ent->fts_level, ent->fts_path);
+        return s;
       }
 
     case FTS_DC:		/* directory that causes cycles */
-      emit_cycle_warning (ent->fts_path);
+      /* As emit_cycle_warning, but through the callbacks.  */
+      rm_error (x, 0, _("\
+WARNING: Circular directory structure.\n\
+This almost certainly means that you have a corrupted file system.\n\
+NOTIFY YOUR SYSTEM MANAGER.\n\
+The following directory is part of the cycle:\n  %s\n"),
+                quote (ent->fts_path));
       fts_skip_tree (fts, ent);
       return RM_ERROR;
 
     case FTS_ERR:
       /* Various failures, from opendir to ENOMEM, to failure to "return"
          to preceding directory, can provoke this.  */
-      error (0, ent->fts_errno, _("traversal failed: %s"),
-             quote (ent->fts_path));
+      rm_error (x, ent->fts_errno, _("traversal failed: %s"),
+                quote (ent->fts_path));
       fts_skip_tree (fts, ent);
       return RM_ERROR;
 
     default:
-      error (0, 0, _("unexpected failure: fts_info=%d: %s\n"
-                     "please report to %s"),
-             ent->fts_info,
-             quote (ent->fts_path),
-             PACKAGE_BUGREPORT);
+      rm_error (x, 0, _("unexpected failure: fts_info=%d: %s\n"
+                        "please report to %s"),
+                ent->fts_info,
+                quote (ent->fts_path),
+                PACKAGE_BUGREPORT);
       abort ();
     }
 }
 
-/* Check for ENT->fts_accpath in the warnings table and prompt the user if
-   found.  Return false if the user declines to continue.  Responses are
-   cached so if we see the file again while removing we won't prompt.  */
-bool
-check_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
+/* The pre-scan of the operands hands the subdirectories of each one
+   to as many as this many threads.  Since the scan is mostly waiting
+   on the file system, more threads than processors may not help.  */
+enum { PRESCAN_MAX_THREADS = 8 };
+
+/* A file under an operand found in the warnings table.  */
+struct warning_hit
+{
+  char *filename;
+  struct warnings_entry *entry;
+  bool via_symlink;
+};
+
+struct prescan
+{
+  struct rm_options const *x;
+  int bit_flags;
+
+  /* Everything below is protected by LOCK, as are the responses and
+     seen flags of the warnings entries.  */
+  pthread_mutex_t lock;
+  pthread_cond_t queue_changed;
+
+  /* What the scan found, for rm to reuse.  */
+  struct scan_snapshot *snapshot;
+
+  /* Directories waiting for a thread to scan them.  */
+  char **queue;
+  size_t n_queued;
+  size_t queue_alloc;
+  /* True once the main thread has queued all it will.  */
+  bool queue_closed;
+
+  pthread_t *thread;
+  size_t n_threads;
+  size_t max_threads;
+
+  struct warning_hit *hit;
+  size_t n_hits;
+  size_t hits_alloc;
+
+  /* With --pipeline, the directories beneath which nothing is listed,
+     waiting for REMOVER to remove them while the scan goes on.  */
+  bool pipeline;
+  char **removable;
+  size_t n_removable;
+  size_t removable_alloc;
+  /* True once nothing more will be added to REMOVABLE.  */
+  bool removable_closed;
+  pthread_cond_t removable_changed;
+  pthread_t remover;
+  bool remover_started;
+  /* True if the remover is not to start before check_finish.  */
+  bool hold_removal;
+  /* True if REMOVER failed to remove something.  */
+  bool remover_failed;
+
+  /* True if there is nothing more to find.  */
+  bool done;
+  /* True if an error stopped the scan.  */
+  bool failed;
+};
+
+/* Return true if the pre-scan can pass over ENT, a non-directory
+   whose name is not protected.  Only a symbolic link, or an entry of
+   unknown type, can still lead to a protected directory.  */
+static bool
+skippable_entry (FTSENT const *ent, struct rm_options const *x)
+{
+  if (! x->recursive)
+    return true;
+  switch (ent->fts_info)
+    {
+    case FTS_SL:
+    case FTS_SLNONE:
+      return false;
+    case FTS_NSOK:
+      return ! (S_ISLNK (ent->fts_statp->st_mode)
+                || (ent->fts_statp->st_mode & S_IFMT) == 0);
+    default:
+      return true;
+    }
+}
+
+/* Return true if the pre-scan S can skip the contents of a directory
+   whose node in the warnings table is NODE.  */
+static bool
+prescan_skip_dir (struct prescan *s, struct warn_node const *node)
+{
+  pthread_mutex_lock (&s->lock);
+  bool skip = s->done || ! node;
+  pthread_mutex_unlock (&s->lock);
+  return skip;
+}
+
+/* Record that ENT was found in the warnings table as ENTRY, or not
+   found if ENTRY is NULL.  */
+static void
+prescan_add_hit (struct prescan *s, FTSENT const *ent,
+                 struct warnings_entry *entry, bool via_symlink)
+{
+  pthread_mutex_lock (&s->lock);
+  if (ent->fts_level != FTS_ROOTLEVEL)
+    snapshot_add_entry (s->snapshot, ent, entry, via_symlink);
+  if (! entry)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return;
+    }
+  if (s->n_hits == s->hits_alloc)
+    s->hit = x2nrealloc (s->hit, &s->hits_alloc, sizeof *s->hit);
+  s->hit[s->n_hits].filename = xstrdup (ent->fts_path);
+  s->hit[s->n_hits].entry = entry;
+  s->hit[s->n_hits].via_symlink = via_symlink;
+  s->n_hits++;
+  /* The scan is done once it has found each protected file under the
+     operands by its own name, so that unique_hits keeps that hit.  */
+  if (! via_symlink)
+    entry->seen = true;
+  s->done = warnings_table_all_seen (s->x->warnings_table);
+  pthread_mutex_unlock (&s->lock);
+}
+
+static void *prescan_thread (void *arg);
+static void *prescan_remover (void *arg);
+
+/* Hand the directory FILE, beneath which nothing needs a prompt, to
+   the thread that removes such directories while the pre-scan S goes
+   on, starting it if need be, or else keeping FILE for it to start on
+   in check_finish.  If it can't be started, leave FILE for rm.  */
+static void
+prescan_certify (struct prescan *s, char const *file)
+{
+  pthread_mutex_lock (&s->lock);
+  if (! s->remover_started && ! s->hold_removal)
+    s->remover_started = (pthread_create (&s->remover, NULL,
+                                          prescan_remover, s) == 0);
+  if (s->remover_started || s->hold_removal)
+    {
+      if (s->n_removable == s->removable_alloc)
+        s->removable = x2nrealloc (s->removable, &s->removable_alloc,
+                                   sizeof *s->removable);
+      s->removable[s->n_removable++] = xstrdup (file);
+      pthread_cond_signal (&s->removable_changed);
+    }
+  pthread_mutex_unlock (&s->lock);
+}
+
+/* The directories that one walk of the pre-scan has found nothing
+   under, kept until the walk is done with their parent: if the parent
+   turns out to need a prompt they are certified one by one, and
+   otherwise the parent is certified in their place.  */
+struct clean_dir
+{
+  char *path;
+  ptrdiff_t level;
+};
+
+struct clean_dirs
+{
+  struct clean_dir *dir;
+  size_t n_dirs;
+  size_t dirs_alloc;
+};
+
+/* Forget the directories at LEVEL or deeper in CLEAN, certifying them
+   for the pre-scan S if CERTIFY.  */
+static void
+clean_dirs_pop (struct prescan *s, struct clean_dirs *clean,
+                ptrdiff_t level, bool certify)
+{
+  while (clean->n_dirs && level <= clean->dir[clean->n_dirs - 1].level)
+    {
+      char *path = clean->dir[--clean->n_dirs].path;
+      if (certify)
+        prescan_certify (s, path);
+      free (path);
+    }
+}
+
+/* Note that what is under ENT needs a prompt, or may, so that neither
+   ENT, if it is a directory, nor any of its ancestors is certified.  */
+static void
+prescan_taint (FTSENT *ent)
+{
+  if (ent->fts_info == FTS_D)
+    ent->fts_number = 1;
+  mark_ancestor_dirs (ent);
+}
+
+/* Once the pre-scan S has walked all of the directory ENT, certify
+   ENT if nothing under it needs a prompt and the walk found it below
+   an operand, or else the directories under ENT that CLEAN keeps.
+   The walk hands subdirectories of its operands to other threads if
+   FAN_OUT.  */
+static void
+prescan_dir_done (FTS *fts, FTSENT *ent, struct prescan *s,
+                  struct clean_dirs *clean, bool fan_out)
+{
+  bool operand = fan_out && ent->fts_level == FTS_ROOTLEVEL;
+  bool clean_dir = (! ent->fts_number && ! operand
+                    && (! s->x->one_file_system
+                        || ent->fts_statp->st_dev == fts->fts_dev));
+
+  clean_dirs_pop (s, clean, ent->fts_level + 1, ! clean_dir);
+  if (! clean_dir)
+    prescan_taint (ent);
+  else if (ent->fts_level == FTS_ROOTLEVEL)
+    prescan_certify (s, ent->fts_path);
+  else
+    {
+      if (clean->n_dirs == clean->dirs_alloc)
+        clean->dir = x2nrealloc (clean->dir, &clean->dirs_alloc,
+                                 sizeof *clean->dir);
+      clean->dir[clean->n_dirs].path = xstrdup (ent->fts_path);
+      clean->dir[clean->n_dirs].level = ent->fts_level;
+      clean->n_dirs++;
+    }
+}
+
+/* Hand the directory ENT to another thread to scan, and return true,
+   or return false if the caller should scan it itself.  */
+static bool
+prescan_queue (struct prescan *s, FTSENT const *ent)
 {
+  bool queued = false;
+
+  pthread_mutex_lock (&s->lock);
+  if (s->n_threads < s->max_threads
+      && pthread_create (&s->thread[s->n_threads], NULL,
+                         prescan_thread, s) == 0)
+    s->n_threads++;
+  if (s->n_threads)
+    {
+      if (s->n_queued == s->queue_alloc)
+        s->queue = x2nrealloc (s->queue, &s->queue_alloc, sizeof *s->queue);
+      s->queue[s->n_queued++] = xstrdup (ent->fts_path);
+      pthread_cond_signal (&s->queue_changed);
+      queued = true;
+    }
+  pthread_mutex_unlock (&s->lock);
+  return queued;
+}
+
+/* Check for ENT->fts_accpath in the warnings table, and record it in S
+   if found.  Return false if an error occurs.  If FAN_OUT, hand the
+   subdirectories of the operands to other threads.  With --pipeline,
+   keep in CLEAN the directories walked so far with nothing under them
+   that needs a prompt.
+
+   Each directory's node in the warnings table, if some protected file
+   is named beneath it, is kept in ENT->fts_pointer, and only
+   directories with a node are descended into.  Anything this misses,
+   such as a symbolic link to a protected directory, or a hard link or
+   bind mount of a protected file, is still caught by warn when it is
+   about to be removed.  */
+static bool
+check_fts (FTS *fts, FTSENT *ent, struct prescan *s,
+           struct clean_dirs *clean, bool fan_out)
+{
+  struct rm_options const *x = s->x;
+  struct warn_node *node = NULL;
+
   switch (ent->fts_info)
     {
     case FTS_D:			/* preorder directory */
@@ -706,6 +2043,50 @@ check_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
           return true;
         }
 
+      if (ent->fts_level == FTS_ROOTLEVEL)
+        node = warnings_table_node (x->warnings_table, ent->fts_path);
+      else
+        {
+          node = warnings_node_child (x->warnings_table,
+                                      ent->fts_parent->fts_pointer,
+                                      ent->fts_name);
+          bool skip = prescan_skip_dir (s, node);
+          if (skip || same_dev_mount_point (fts, ent, x))
+            {
+              /* With nothing listed beneath it, what is under ENT
+                 needs no prompt from the scan, so --pipeline can
+                 remove it now.  Not across file systems, though, with
+                 --one-file-system.  */
+              if (skip && ! node && s->pipeline
+                  && (! x->one_file_system
+                      || (ent->fts_statp->st_dev == fts->fts_dev
+                          && ! same_dev_mount_point (fts, ent, x))))
+                prescan_certify (s, ent->fts_path);
+              else
+                prescan_taint (ent);
+              fts_skip_tree (fts, ent);
+              return true;
+            }
+
+          /* The thread that scans the subdirectory checks it too.  */
+          if (fan_out && ent->fts_level == FTS_ROOTLEVEL + 1
+              && prescan_queue (s, ent))
+            {
+              fts_skip_tree (fts, ent);
+              return true;
+            }
+        }
+      ent->fts_pointer = node;
+      if (ent->fts_level == FTS_ROOTLEVEL && prescan_skip_dir (s, node))
+        fts_skip_tree (fts, ent);
+      else
+        {
+          stats_count (x->context->stats, STATS_SITE_PRESCAN, STATS_READDIR);
+          pthread_mutex_lock (&s->lock);
+          snapshot_add_dir (s->snapshot, ent);
+          pthread_mutex_unlock (&s->lock);
+        }
+
       /* Fall through.  */
 
     case FTS_F:			/* regular file */
@@ -716,37 +2097,372 @@ check_fts (FTS *fts, FTSENT *ent, struct rm_options const *x)
     case FTS_NSOK:		/* e.g., dangling symlink */
     case FTS_DEFAULT:		/* none of the above */
       {
-        struct stat st;
-        cache_stat_init (&st);
+        if (ent->fts_info != FTS_D
+            && ent->fts_level != FTS_ROOTLEVEL
+            && ! warnings_node_child (x->warnings_table,
+                                      ent->fts_parent->fts_pointer,
+                                      ent->fts_name)
+            && skippable_entry (ent, x))
+          return true;
 
-        enum warn_status status = warn (ent, fts->fts_cwd_fd, &st, x);
-        return (status == WARN_OK) | (status == WARN_NOT_FOUND);
+        struct stat_cache st;
+        cache_stat_init (&st, x->context->stats, STATS_SITE_PRESCAN);
+
+        struct warnings_entry *found;
+        bool via_symlink;
+        enum warn_status status = find_warning (ent, fts->fts_cwd_fd, &st, x,
+                                                false, &found, &via_symlink);
+        if (status == WARN_ERROR)
+          return false;
+        prescan_add_hit (s, ent, status == WARN_OK ? found : NULL,
+                         via_symlink);
+
+        /* Nor may anything be removed early that leads to a directory
+           the scan has not read, or that it could not check.  */
+        struct stat dir_st;
+        if (s->pipeline
+            && (status == WARN_OK
+                || ent->fts_info == FTS_NS || ent->fts_info == FTS_DNR
+                || (ent->fts_info != FTS_D && ! skippable_entry (ent, x)
+                    && symlink_to_dir (x->context->caches, ent,
+                                       fts->fts_cwd_fd, &dir_st, &st))))
+          prescan_taint (ent);
+        return true;
       }
 
     case FTS_DC:
     case FTS_ERR:
+      if (s->pipeline)
+        prescan_taint (ent);
       fts_skip_tree (fts, ent);
       return true;
 
     case FTS_DP:
+      if (s->pipeline)
+        prescan_dir_done (fts, ent, s, clean, fan_out);
+      return true;
+
+    default:
       return true;
     }
 }
 
+/* Scan FILEs for the pre-scan S, handing their subdirectories to
+   other threads if FAN_OUT.  */
+static void
+prescan_files (struct prescan *s, char *const *file, bool fan_out)
+{
+  bool ok = true;
+  FTS *fts = xfts_open (file, s->bit_flags, NULL);
+  struct clean_dirs clean = { NULL, 0, 0 };
+
+  while (1)
+    {
+      if (s->x->context->canceled)
+        {
+          ok = false;
+          break;
+        }
+      if (s->x->context->snapshot_wanted)
+        send_snapshot (s->x->context);
+
+      FTSENT *ent = fts_read (fts);
+      if (ent == NULL)
+        {
+          if (errno != 0)
+            {
+              rm_error (s->x, errno, _("fts_read failed"));
+              ok = false;
+            }
+          break;
+        }
+
+      if (! check_fts (fts, ent, s, &clean, fan_out))
+        {
+          ok = false;
+          break;
+        }
+    }
+
+  clean_dirs_pop (s, &clean, FTS_ROOTLEVEL, false);
+  free (clean.dir);
+
+  if (fts_close (fts) != 0)
+    {
+      rm_error (s->x, errno, _("fts_close failed"));
+      ok = false;
+    }
+
+  if (! ok)
+    {
+      pthread_mutex_lock (&s->lock);
+      s->failed = s->done = true;
+      pthread_mutex_unlock (&s->lock);
+    }
+}
+
+/* Scan the directories queued for the pre-scan ARG until the queue is
+   closed and empty.  */
+static void *
+prescan_thread (void *arg)
+{
+  struct prescan *s = arg;
+
+  while (1)
+    {
+      pthread_mutex_lock (&s->lock);
+      while (s->n_queued == 0 && ! s->queue_closed)
+        pthread_cond_wait (&s->queue_changed, &s->lock);
+      char *dir = s->n_queued ? s->queue[--s->n_queued] : NULL;
+      pthread_mutex_unlock (&s->lock);
+
+      if (! dir)
+        return NULL;
+      char *file[2] = { dir, NULL };
+      prescan_files (s, file, false);
+      free (dir);
+    }
+}
+
+/* Remove the directories handed over by the pre-scan ARG until there
+   are no more, leaving anything that needs a prompt for rm.  */
+static void *
+prescan_remover (void *arg)
+{
+  struct prescan *s = arg;
+  struct rm_options x = *s->x;
+
+  /* The directories are not operands, and the pre-scan is still filling
+     in the snapshot.  */
+  x.defer_prompts = true;
+  x.preserve_all_root = false;
+  x.snapshot = NULL;
+
+  while (1)
+    {
+      pthread_mutex_lock (&s->lock);
+      while (s->n_removable == 0 && ! s->removable_closed)
+        pthread_cond_wait (&s->removable_changed, &s->lock);
+      char *dir = s->n_removable ? s->removable[--s->n_removable] : NULL;
+      pthread_mutex_unlock (&s->lock);
+
+      if (! dir)
+        return NULL;
+      char *file[2] = { dir, NULL };
+      if (rm (file, &x) == RM_ERROR)
+        s->remover_failed = true;
+      free (dir);
+    }
+}
+
+static int
+compare_hits (void const *a, void const *b)
+{
+  struct warning_hit const *ha = a;
+  struct warning_hit const *hb = b;
+  return strcmp (ha->filename, hb->filename);
+}
+
+/* Order hits by entry, and for each entry put first a hit by its own
+   name rather than through a symbolic link, then the first by file
+   name.  */
+static int
+compare_hit_entries (void const *a, void const *b)
+{
+  struct warning_hit const *ha = a;
+  struct warning_hit const *hb = b;
+  if (ha->entry != hb->entry)
+    return ha->entry < hb->entry ? -1 : 1;
+  if (ha->via_symlink != hb->via_symlink)
+    return ha->via_symlink - hb->via_symlink;
+  return strcmp (ha->filename, hb->filename);
+}
+
+/* Keep one of the N_HITS hits in HIT for each entry, and return how
+   many are left.  The scan stops once it has found every protected
+   file under the operands, so which other paths to the same entry it
+   met first depends on its threads, but the hit kept for those files
+   is always the one by their own name.  */
+static size_t
+unique_hits (struct warning_hit *hit, size_t n_hits)
+{
+  size_t n = 0;
+  size_t i;
+
+  qsort (hit, n_hits, sizeof *hit, compare_hit_entries);
+  for (i = 0; i < n_hits; i++)
+    if (n && hit[n - 1].entry == hit[i].entry)
+      free (hit[i].filename);
+    else
+      hit[n++] = hit[i];
+  return n;
+}
+
 struct dir_prefix
 {
   /* The directory name, not NULL-terminated.  */
   char *dirname;
   /* The length of the directory name.  */
   size_t len;
-  /* A table of file names found in with this directory prefix.  */
-  Hash_table *filenames;
+  /* True once the directory has been looked up in the warnings table,
+     and its entry there, if it is protected.  */
+  bool looked_up;
+  struct warnings_entry *found;
+  /* The file names given with this directory prefix, once it is known
+     to be protected.  */
+  char const **name;
+  size_t n_names;
+  size_t names_alloc;
 };
 
+static size_t
+dir_prefix_hash (void const *p, size_t n_buckets)
+{
+  struct dir_prefix const *pfix = p;
+  size_t h = 0;
+  size_t i;
+  for (i = 0; i < pfix->len; i++)
+    h = h * 31 + (unsigned char) pfix->dirname[i];
+  return h % n_buckets;
+}
+
 static bool
-streq (void const *p1, void const *p2)
+dir_prefix_comparator (void const *p1, void const *p2)
+{
+  struct dir_prefix const *a = p1, *b = p2;
+  return a->len == b->len && memcmp (a->dirname, b->dirname, a->len) == 0;
+}
+
+static void
+dir_prefix_free (void *p)
+{
+  struct dir_prefix *pfix = p;
+  free (pfix->name);
+  free (pfix);
+}
+
+static int
+compare_names (void const *a, void const *b)
+{
+  return strcmp (*(char const *const *) a, *(char const *const *) b);
+}
+
+/* Return the prefix of FILE in PREFIXES, adding it if ADD, or NULL if
+   it isn't there.  */
+static struct dir_prefix *
+find_prefix (Hash_table *prefixes, char *file, bool add)
+{
+  struct dir_prefix key;
+  key.dirname = file;
+  key.len = dir_len (file);
+
+  struct dir_prefix *pfix = hash_lookup (prefixes, &key);
+  if (! pfix && add)
+    {
+      pfix = xmalloc (sizeof *pfix);
+      *pfix = key;
+      pfix->looked_up = false;
+      pfix->found = NULL;
+      pfix->name = NULL;
+      pfix->n_names = pfix->names_alloc = 0;
+      if (! hash_insert (prefixes, pfix))
+        xalloc_die ();
+    }
+  return pfix;
+}
+
+/* Return the number of non-dot files in DIRNAME, a directory whose
+   files are given as the sorted array NAME of N_NAMES names, or 0 if
+   it has any file that is not given.  Return SIZE_MAX if DIRNAME
+   can't be read, having reported why as X says.  */
+static size_t
+count_given_files (char const *dirname, char const **name, size_t n_names,
+                   struct rm_options const *x)
+{
+  stats_count (x->context->stats, STATS_SITE_GLOBS, STATS_READDIR);
+  DIR *dir = opendir (dirname);
+  if (! dir)
+    {
+      rm_error (x, errno, _("cannot open directory %s"), quote (dirname));
+      return SIZE_MAX;
+    }
+
+  char **entry = NULL;
+  size_t n_entries = 0, entries_alloc = 0;
+  struct dirent *dirent;
+  bool ok = true;
+
+  /* readdir sets errno on failure but not on success.  */
+  errno = 0;
+  while ((dirent = readdir (dir)))
+    {
+      if (dirent->d_name[0] == '.')
+        continue;
+      if (n_entries == entries_alloc)
+        entry = x2nrealloc (entry, &entries_alloc, sizeof *entry);
+      entry[n_entries++] = xstrdup (dirent->d_name);
+    }
+  if (errno)
+    {
+      rm_error (x, errno, _("error reading directory %s"), quote (dirname));
+      ok = false;
+    }
+  if (-1 == closedir (dir) && ok)
+    {
+      rm_error (x, errno, _("cannot close directory %s"), quote (dirname));
+      ok = false;
+    }
+
+  /* Both lists are sorted, so each file of the directory can be
+     looked for in the given names where the last one was found.  */
+  qsort (entry, n_entries, sizeof *entry, compare_names);
+  size_t i, j = 0;
+  for (i = 0; i < n_entries; i++)
+    {
+      int cmp = 1;
+      while (j < n_names && (cmp = strcmp (name[j], entry[i])) < 0)
+        j++;
+      if (cmp != 0)
+        break;
+    }
+  size_t n_files = ! ok ? SIZE_MAX : i == n_entries ? n_entries : 0;
+
+  for (i = 0; i < n_entries; i++)
+    free (entry[i]);
+  free (entry);
+  return n_files;
+}
+
+/* A protected directory all of whose non-dot files are among the
+   operands, as if from a glob.  */
+struct glob_hit
 {
-  return 0 == strcmp (p1, p2);
+  struct warnings_entry *found;
+  size_t n_files;
+};
+
+/* What check_globs_start found for check_globs_finish.  */
+struct glob_check
+{
+  struct glob_hit *hit;
+  size_t n_hits;
+  size_t hits_alloc;
+  /* True if a directory could not be checked.  */
+  bool failed;
+};
+
+/* Return *G, allocating it if it is NULL.  */
+static struct glob_check *
+glob_check (struct glob_check **g)
+{
+  if (! *g)
+    {
+      *g = xmalloc (sizeof **g);
+      (*g)->hit = NULL;
+      (*g)->n_hits = (*g)->hits_alloc = 0;
+      (*g)->failed = false;
+    }
+  return *g;
 }
 
 /* Checks the list FILEs given on the command line for cases such as
@@ -760,65 +2476,37 @@ streq (void const *p1, void const *p2)
    To do this we group arguments that could come from the same glob
    and for each of those groups check to see if the containing
    directory is in X->warnings_table, and every file of the directory
-   is in the arguments list.  Prompt the user if the above conditions
-   are met, and return true only if the user permits us to continue,
-   or we didn't prompt.  */
-bool
-check_globs (char *const *file, struct rm_options const *x)
+   is in the arguments list.  Return what check_globs_finish is to
+   prompt the user about, or report, or NULL if there is nothing.  */
+struct glob_check *
+check_globs_start (char *const *file, struct rm_options const *x)
 {
-  /* There tends to be very few distinct directory prefixes on the
-     command line, at least when used by a human.  Hence we use a
-     resizable array rather than a hash table for performance.  */
-  size_t n_prefixes = 0, prefixes_alloced = 16;
-  struct dir_prefix *prefixes = xmalloc (prefixes_alloced * sizeof *prefixes);
+  /* A glob can only be caught in a protected directory.  */
+  if (! warnings_table_has_dirs (x->warnings_table))
+    return NULL;
+
+  /* A glob that matches files in many directories gives as many
+     distinct directory prefixes, so they are hashed.  */
+  Hash_table *prefixes = hash_initialize (17, NULL, dir_prefix_hash,
+                                          dir_prefix_comparator,
+                                          dir_prefix_free);
+  if (! prefixes)
+    xalloc_die ();
+  char *const *f;
   struct dir_prefix *pfix;
-  size_t i;
-  bool check_ok = true;
+  bool any_found = false;
+  struct glob_check *g = NULL;
 
-  /* Store each argument basename in a table under its directory
-     prefix.  I.e., for argument "foo/bar/baz", store "baz" in the
-     table under prefix "foo/bar".  */
-  for ( ; *file; ++file)
+  /* Find out which directory prefixes are in the warnings table.  */
+  for (f = file; *f; ++f)
     {
-      size_t len = dir_len (*file);
-      for (i = 0; i < n_prefixes; ++i)
-        {
-          pfix = &prefixes[i];
-          if (len == pfix->len && 0 == strncmp (*file, pfix->dirname, len))
-            break;
-        }
-      if (i == n_prefixes)
-        {
-          if (n_prefixes == prefixes_alloced)
-            {
-              prefixes_alloced *= 2;
-              prefixes = xrealloc (prefixes,
-                                   prefixes_alloced * sizeof *prefixes);
-            }
-          pfix = &prefixes[n_prefixes++];
-          pfix->dirname = *file;
-          pfix->len = len;
-          pfix->filenames = hash_initialize (17, NULL, hash_pjw, streq, NULL);
-          if (! pfix->filenames)
-            xalloc_die ();
-        }
-      char const *filename = *file + len;
-      while (ISSLASH (*filename))
-        ++filename;
-      if (! hash_insert (pfix->filenames, filename))
-        xalloc_die ();
-    }
+      pfix = find_prefix (prefixes, *f, true);
+      if (pfix->looked_up)
+        continue;
+      pfix->looked_up = true;
 
-  /* For each directory prefix in the argument list, check if it's in
-     the warnings table, and if so, read the directory and see if
-     every non-dot file in the directory is listed in the arguments.
-     This will catch a glob in that directory, sans race conditions,
-     which is better than nothing.  */
-  for (i = 0; check_ok && i < n_prefixes; ++i)
-    {
       struct stat st;
       char const *dirname;
-      pfix = &prefixes[i];
       if (pfix->len == 0)
         dirname = ".";
       else
@@ -828,129 +2516,442 @@ check_globs (char *const *file, struct rm_options const *x)
           dirname = pfix->dirname;
         }
 
+      stats_count (x->context->stats, STATS_SITE_GLOBS, STATS_STAT);
       if (-1 == stat (dirname, &st))
         {
           if (! ignorable_missing (x, errno))
-            error (EXIT_FAILURE, errno, _("cannot stat %s"), quote (dirname));
+            {
+              rm_error (x, errno, _("cannot stat %s"), quote (dirname));
+              glob_check (&g)->failed = true;
+            }
         }
-      else
+      else if ((pfix->found = warnings_table_lookup (x->warnings_table, &st)))
+        any_found = true;
+
+      if (pfix->len)
+        pfix->dirname[pfix->len] = DIRECTORY_SEPARATOR;
+      if (g)
         {
-          /* Check if the directory is in the warnings table and if so
-             check the contents.  */
-          struct warnings_entry *found =
-            warnings_table_lookup (x->warnings_table, &st);
-          if (found)
-            {
-              DIR *dir = opendir (dirname);
-              if (! dir)
-                error (EXIT_FAILURE, errno, _("cannot open directory %s"),
-                       quote (dirname));
-
-              struct dirent *dirent;
-              size_t n_files = 0;
-
-              /* readdir sets errno on failure but not on success.  */
-              errno = 0;
-              while ((dirent = readdir (dir)))
-                {
-                  if (dirent->d_name[0] == '.')
-                    continue;
-                  if (! hash_lookup (pfix->filenames, dirent->d_name))
-                    break;
-                  n_files++;
-                }
-              if (dirent == NULL)
-                {
-                  if (errno)
-                    error (EXIT_FAILURE, errno,
-                           _("error reading directory %s"), quote (dirname));
-
-                  if (n_files)
-                    {
-                      char *glob =
-                        xconcatenated_filename (found->given_path, "*", NULL);
-                      char const *s = (n_files == 1) ? "" : "s";
-                      issue_warning(_("you are about to remove"
-                                      " %zd file%s via %s; continue? "),
-                                    n_files, s, quote (glob));
-                      free (glob);
-                      /* If they want to remove the glob contents,
-                         don't bother them later about whether they
-                         want to remove the directory.  */
-                      found->response = yesno () ? T_YES : T_NO;
-
-                      if (found->response == T_NO)
-                        check_ok = false;
-                    }
-                } /* end if (dirent == NULL) */
-
-              if (-1 == closedir (dir))
-                error (EXIT_FAILURE, errno, _("cannot close directory %s"),
-                       quote (dirname));
-
-            } /* end if (found) */
-
-        } /* end if (-1 != stat (dirname, &st)) */
+          hash_free (prefixes);
+          return g;
+        }
+    }
+
+  /* Store the basename of each argument under a protected prefix.
+     I.e., for argument "foo/bar/baz", store "baz" under "foo/bar".  */
+  if (any_found)
+    for (f = file; *f; ++f)
+      {
+        pfix = find_prefix (prefixes, *f, false);
+        if (! pfix->found)
+          continue;
+        char const *filename = *f + pfix->len;
+        while (ISSLASH (*filename))
+          ++filename;
+        if (pfix->n_names == pfix->names_alloc)
+          pfix->name = x2nrealloc (pfix->name, &pfix->names_alloc,
+                                   sizeof *pfix->name);
+        pfix->name[pfix->n_names++] = filename;
+      }
 
+  /* For each protected directory prefix, read the directory and see
+     if every non-dot file in it is listed in the arguments.  This
+     will catch a glob in that directory, sans race conditions, which
+     is better than nothing.  Go through the prefixes in the order of
+     the arguments, so that the prompts are too.  */
+  for (f = file; any_found && *f; ++f)
+    {
+      pfix = find_prefix (prefixes, *f, false);
+      if (! pfix->found || ! pfix->name)
+        continue;
+
+      qsort (pfix->name, pfix->n_names, sizeof *pfix->name, compare_names);
+      char const *dirname = ".";
+      if (pfix->len)
+        {
+          pfix->dirname[pfix->len] = '\0';
+          dirname = pfix->dirname;
+        }
+      size_t n_files = count_given_files (dirname, pfix->name,
+                                          pfix->n_names, x);
       if (pfix->len)
         pfix->dirname[pfix->len] = DIRECTORY_SEPARATOR;
 
-    } /* end for (check_ok && i < n_prefixes) */
+      /* Each prefix is checked only once.  */
+      free (pfix->name);
+      pfix->name = NULL;
+      pfix->n_names = pfix->names_alloc = 0;
 
-  while (0 < n_prefixes)
-    hash_free (prefixes[--n_prefixes].filenames);
-  free (prefixes);
+      if (n_files == SIZE_MAX)
+        {
+          glob_check (&g)->failed = true;
+          break;
+        }
+      if (n_files)
+        {
+          glob_check (&g);
+          if (g->n_hits == g->hits_alloc)
+            g->hit = x2nrealloc (g->hit, &g->hits_alloc, sizeof *g->hit);
+          g->hit[g->n_hits].found = pfix->found;
+          g->hit[g->n_hits].n_files = n_files;
+          g->n_hits++;
+        }
+    }
 
-  return check_ok;
+  hash_free (prefixes);
+  return g;
 }
 
-/* Check for any FILEs in the warnings table that will be removed and give the
-   user a chance for early exit.  Return true if it is OK to proceed, false if
-   rm should be skipped.  */
-bool
-check (char *const *file, struct rm_options const *x)
+/* Prompt the user about each glob that check_globs_start found in G,
+   and free G.  Return RM_OK only if the user permits us to continue,
+   or we didn't prompt, RM_USER_DECLINED if not, and RM_ERROR if the
+   check failed.  */
+enum RM_status
+check_globs_finish (struct glob_check *g, struct rm_options const *x)
 {
-  bool status = true;
+  bool check_ok = true;
+  size_t i;
 
-  if (*file)
+  if (! g)
+    return RM_OK;
+
+  /* A policy goes on after a refusal, to list everything it refuses.  */
+  for (i = 0;
+       (! g->failed && (check_ok || x->warnings_policy != WARNINGS_ASK)
+        && i < g->n_hits);
+       i++)
+    {
+      struct warnings_entry *found = g->hit[i].found;
+      size_t n_files = g->hit[i].n_files;
+      char *glob = xconcatenated_filename (found->given_path, "*", NULL);
+      char const *s = (n_files == 1) ? "" : "s";
+      /* If they want to remove the glob contents, don't bother
+         them later about whether they want to remove the
+         directory.  */
+      if (x->warnings_policy != WARNINGS_ASK)
+        found->response = policy_response (found->given_path, glob, x);
+      else
+        found->response = (rm_ask (x, RMFD_ASK_WARNING,
+                                   _("you are about to remove"
+                                     " %zd file%s via %s; continue? "),
+                                   n_files, s, quote (glob))
+                           ? T_YES : T_NO);
+      free (glob);
+
+      if (found->response == T_NO)
+        check_ok = false;
+    }
+
+  enum RM_status status = (g->failed ? RM_ERROR
+                           : check_ok ? RM_OK : RM_USER_DECLINED);
+  free (g->hit);
+  free (g);
+  return status;
+}
+
+/* Free G, which check_globs_start returned, without asking anything.  */
+void
+check_globs_cancel (struct glob_check *g)
+{
+  if (g)
     {
-      int bit_flags = (FTS_CWDFD | FTS_NOSTAT | FTS_PHYSICAL);
+      free (g->hit);
+      free (g);
+    }
+}
 
-      if (x->one_file_system)
-        bit_flags |= FTS_XDEV;
+/* Check the FILEs for globs in protected directories, as
+   check_globs_start describes, and prompt the user about them.  Return
+   as check_globs_finish does.  */
+enum RM_status
+check_globs (char *const *file, struct rm_options const *x)
+{
+  return check_globs_finish (check_globs_start (file, x), x);
+}
 
-      FTS *fts = xfts_open (file, bit_flags, NULL);
+/* The most protected files one prompt lists by name.  */
+enum { WARN_LIST_MAX = 10 };
 
-      while (1)
-        {
-          FTSENT *ent = fts_read (fts);
-          if (ent == NULL)
-            {
-              if (errno != 0)
-                {
-                  error (0, errno, _("fts_read failed"));
-                  status = false;
-                }
-              break;
-            }
+/* Ask the user about the N_HITS files in HIT that the pre-scan found,
+   which are in order of file name, all at once: one prompt for those
+   whose entries the user has not been asked about yet, listing the
+   first WARN_LIST_MAX of them.  Return true if the user allows their
+   removal.  */
+static bool
+confirm_hits (struct warning_hit *hit, size_t n_hits,
+              struct rm_options const *x)
+{
+  size_t n = 0;
+  size_t i;
 
-          if (! check_fts (fts, ent, x))
+  /* Move the hits to ask about to the front, keeping their order,
+     once for each entry.  Mark the entries T_NO meanwhile, so that a
+     later hit for the same one is told apart.  */
+  for (i = 0; i < n_hits; i++)
+    if (hit[i].entry->response == T_UNKNOWN)
+      {
+        struct warning_hit h = hit[i];
+        hit[i] = hit[n];
+        hit[n++] = h;
+        h.entry->response = T_NO;
+      }
+
+  if (n == 0)
+    return true;
+
+  if (n == 1 || x->warnings_policy != WARNINGS_ASK)
+    {
+      /* Go through all of them, so that a policy lists them all.  */
+      bool ok = true;
+      for (i = 0; i < n; i++)
+        hit[i].entry->response = T_UNKNOWN;
+      for (i = 0; i < n; i++)
+        if (confirm_warning (hit[i].entry, hit[i].filename,
+                             hit[i].via_symlink, x) != WARN_OK)
+          ok = false;
+      return ok;
+    }
+
+  /* The question is built a line at a time, all under message_lock.  */
+  lock_message (0);
+  char *question = xasprintf (_("you are about to remove %zu protected"
+                                " files:\n"), n);
+  for (i = 0; i < n && i < WARN_LIST_MAX; i++)
+    {
+      char *q = (hit[i].via_symlink
+                 ? xasprintf (_("%s  the contents of %s through symbolic"
+                                " link %s\n"), question,
+                              quote_n (0, hit[i].entry->given_path),
+                              quote_n (1, hit[i].filename))
+                 : xasprintf ("%s  %s\n", question,
+                              quote (hit[i].entry->given_path)));
+      free (question);
+      question = q;
+    }
+  char *q = (WARN_LIST_MAX < n
+             ? xasprintf (_("%s  and %zu more; --warnings-policy=report"
+                            " lists them all\ncontinue? "),
+                          question, n - WARN_LIST_MAX)
+             : xasprintf (_("%scontinue? "), question));
+  free (question);
+
+  Ternary response = (ask_question (x, RMFD_ASK_WARNING, q)
+                      ? T_YES : T_NO);
+  for (i = 0; i < n; i++)
+    hit[i].entry->response = response;
+  return response == T_YES;
+}
+
+/* Start checking for any FILEs in the warnings table that will be
+   removed: scan the subdirectories of the FILEs, in parallel, for
+   check_finish to ask the user about what was found.  What the scan
+   finds is kept in X->snapshot for rm.  If HOLD_REMOVAL, --pipeline
+   removes nothing until check_finish.  */
+struct prescan *
+check_start (char *const *file, struct rm_options *x, bool hold_removal)
+{
+  if (! *file)
+    return NULL;
+
+  struct prescan *s = xmalloc (sizeof *s);
+  size_t i;
+
+  s->x = x;
+  s->snapshot = x->snapshot = snapshot_create ();
+  s->bit_flags = (FTS_CWDFD | FTS_NOSTAT | FTS_PHYSICAL);
+  if (x->one_file_system)
+    s->bit_flags |= FTS_XDEV;
+  pthread_mutex_init (&s->lock, NULL);
+  pthread_cond_init (&s->queue_changed, NULL);
+  s->queue = NULL;
+  s->n_queued = s->queue_alloc = 0;
+  s->queue_closed = false;
+  s->max_threads = MIN (num_processors (NPROC_CURRENT_OVERRIDABLE),
+                        PRESCAN_MAX_THREADS);
+  if (s->max_threads <= 1)
+    s->max_threads = 0;
+  s->thread = xnmalloc (s->max_threads + 1, sizeof *s->thread);
+  s->n_threads = 0;
+  s->hit = NULL;
+  s->n_hits = s->hits_alloc = 0;
+  s->done = warnings_table_all_seen (x->warnings_table);
+  s->failed = false;
+  s->pipeline = x->pipeline && x->warnings_policy != WARNINGS_REPORT;
+  s->hold_removal = hold_removal;
+  pthread_cond_init (&s->removable_changed, NULL);
+  s->removable = NULL;
+  s->n_removable = s->removable_alloc = 0;
+  s->removable_closed = false;
+  s->remover_started = s->remover_failed = false;
+
+  prescan_files (s, file, true);
+
+  pthread_mutex_lock (&s->lock);
+  s->queue_closed = true;
+  pthread_cond_broadcast (&s->queue_changed);
+  pthread_mutex_unlock (&s->lock);
+  for (i = 0; i < s->n_threads; i++)
+    pthread_join (s->thread[i], NULL);
+
+  return s;
+}
+
+/* Free the pre-scan S, once its threads are done.  */
+static void
+prescan_free (struct prescan *s)
+{
+  size_t i;
+
+  /* Anything the remover didn't get to is left for rm.  */
+  while (s->n_removable)
+    free (s->removable[--s->n_removable]);
+  for (i = 0; i < s->n_hits; i++)
+    free (s->hit[i].filename);
+  free (s->hit);
+  free (s->queue);
+  free (s->thread);
+  free (s->removable);
+  pthread_cond_destroy (&s->removable_changed);
+  pthread_cond_destroy (&s->queue_changed);
+  pthread_mutex_destroy (&s->lock);
+  free (s);
+}
+
+/* Give the user a chance for early exit, if the scan S by check_start
+   found any FILEs in the warnings table that will be removed, and free
+   S.  Return RM_OK if it is OK to proceed, and otherwise, if rm should
+   be skipped, RM_USER_DECLINED, or RM_ERROR if the scan failed.
+
+   The user is asked about what was found only once the scan is over,
+   in a single prompt listing it in order of file name, so that the
+   question doesn't depend on which thread got where first.  */
+enum RM_status
+check_finish (struct prescan *s, struct rm_options *x)
+{
+  if (! s)
+    return RM_OK;
+
+  /* The remover may go on while the user is asked.  */
+  pthread_mutex_lock (&s->lock);
+  s->removable_closed = true;
+  if (s->hold_removal && s->n_removable)
+    s->remover_started = (pthread_create (&s->remover, NULL,
+                                          prescan_remover, s) == 0);
+  pthread_cond_signal (&s->removable_changed);
+  pthread_mutex_unlock (&s->lock);
+
+  enum RM_status status = RM_ERROR;
+  if (! s->failed)
+    {
+      s->n_hits = unique_hits (s->hit, s->n_hits);
+      qsort (s->hit, s->n_hits, sizeof *s->hit, compare_hits);
+      status = (confirm_hits (s->hit, s->n_hits, x)
+                ? RM_OK : RM_USER_DECLINED);
+    }
+
+  /* Once the user declines, remove no more.  */
+  if (status != RM_OK)
+    {
+      pthread_mutex_lock (&s->lock);
+      while (s->n_removable)
+        free (s->removable[--s->n_removable]);
+      pthread_mutex_unlock (&s->lock);
+    }
+  if (s->remover_started)
+    pthread_join (s->remover, NULL);
+  x->pipeline_failed = s->remover_failed;
+
+  prescan_free (s);
+  return status;
+}
+
+/* Free S, which check_start returned with HOLD_REMOVAL, without asking
+   anything or removing anything.  */
+void
+check_cancel (struct prescan *s)
+{
+  if (s)
+    {
+      assert (s->hold_removal && ! s->remover_started);
+      prescan_free (s);
+    }
+}
+
+/* Check for any FILEs in the warnings table that will be removed and give the
+   user a chance for early exit.  Return as check_finish does.  */
+enum RM_status
+check (char *const *file, struct rm_options *x)
+{
+  return check_finish (check_start (file, x, false), x);
+}
+
+/* How many entries rm_loop removes between looking for a cancellation
+   or a snapshot request, unless it enters a directory first.  */
+enum { RM_POLL_INTERVAL = 1024 };
+
+/* Remove what FTS finds, as rm_fts does with FEATURES.  */
+ATTRIBUTE_ALWAYS_INLINE static inline enum RM_status
+rm_loop (FTS *fts, struct rm_options const *x, int features)
+{
+  enum RM_status rm_status = RM_OK;
+  unsigned int countdown = RM_POLL_INTERVAL;
+
+  if (x->context->canceled)
+    return RM_ERROR;
+
+  while (1)
+    {
+      FTSENT *ent;
+
+      /* Reading a directory is done in the fts_read after its FTS_D.  */
+      struct trace *trace = (features & RMF_REPORT) ? x->context->trace : NULL;
+      xtime_t start = trace_start (trace);
+      ent = fts_read (fts);
+      if (ent && trace)
+        trace_call (trace, "fts_read", ent->fts_path, start);
+      if (ent == NULL)
+        {
+          if (errno != 0)
             {
-              status = false;
-              break;
+              rm_error (x, errno, _("fts_read failed"));
+              rm_status = RM_ERROR;
             }
+          return rm_status;
         }
 
-      if (fts_close (fts) != 0)
+      enum RM_status s = rm_fts (fts, ent, x, features);
+
+      /* Keep the directories above what is left for later.  */
+      if (s == RM_USER_DECLINED && x->defer_prompts)
+        mark_ancestor_dirs (ent);
+
+      assert (VALID_STATUS (s));
+      UPDATE_STATUS (rm_status, s);
+
+      /* Rather than on each entry, look for a cancellation or a
+         snapshot request on entering a directory, after any question
+         about it, and every so often in between.  */
+      if (ent->fts_info == FTS_D || --countdown == 0)
         {
-          error (0, errno, _("fts_close failed"));
-          status = false;
+          countdown = RM_POLL_INTERVAL;
+          if (x->context->canceled)
+            return RM_ERROR;
+          if (x->context->snapshot_wanted)
+            send_snapshot (x->context);
         }
     }
-
-  return status;
 }
 
+/* The cases of a switch on FEATURES, from F to F + N - 1, that run the
+   variant of rm_loop for each.  */
+#define RM_LOOP_CASES_1(F) \
+  case F: rm_status = rm_loop (fts, x, F); break;
+#define RM_LOOP_CASES_2(F) RM_LOOP_CASES_1 (F) RM_LOOP_CASES_1 ((F) + 1)
+#define RM_LOOP_CASES_4(F) RM_LOOP_CASES_2 (F) RM_LOOP_CASES_2 ((F) + 2)
+#define RM_LOOP_CASES_8(F) RM_LOOP_CASES_4 (F) RM_LOOP_CASES_4 ((F) + 4)
+#define RM_LOOP_CASES_16(F) RM_LOOP_CASES_8 (F) RM_LOOP_CASES_8 ((F) + 8)
+verify (RMF_ALL == 16 - 1);
+
 /* Remove FILEs, honoring options specified via X.
    Return RM_OK if successful.  */
 enum RM_status
@@ -969,33 +2970,22 @@ rm (char *const *file, struct rm_options const *x)
 
       FTS *fts = xfts_open (file, bit_flags, NULL);
 
-      while (1)
+      switch (rm_fts_features (x))
         {
-          FTSENT *ent;
-
-          ent = fts_read (fts);
-          if (ent == NULL)
-            {
-              if (errno != 0)
-                {
-                  error (0, errno, _("fts_read failed"));
-                  rm_status = RM_ERROR;
-                }
-              break;
-            }
-
-          enum RM_status s = rm_fts (fts, ent, x);
-
-          assert (VALID_STATUS (s));
-          UPDATE_STATUS (rm_status, s);
+          RM_LOOP_CASES_16 (0)
+        default:
+          abort ();
         }
 
       if (fts_close (fts) != 0)
         {
-          error (0, errno, _("fts_close failed"));
+          rm_error (x, errno, _("fts_close failed"));
           rm_status = RM_ERROR;
         }
     }
 
+  if (x->pipeline_failed)
+    rm_status = RM_ERROR;
+
   return rm_status;
 }
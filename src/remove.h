@@ -18,8 +18,13 @@
 #ifndef REMOVE_H
 # define REMOVE_H
 
+# include <pthread.h>
+# include <signal.h>
 # include "dev-ino.h"
-# include "hash.h"
+# include "rmfd.h"
+# include "stats.h"
+# include "trace.h"
+# include "warnings.h"
 
 enum rm_interactive
 {
@@ -30,22 +35,65 @@ enum rm_interactive
   RMI_NEVER
 };
 
-enum Ternary
+/* How --warnings answers its own questions, for unattended runs.  */
+enum warnings_policy
 {
-  T_UNKNOWN = 2,
-  T_NO,
-  T_YES
+  /* Prompt the user.  */
+  WARNINGS_ASK = 2,
+  /* Decline, as if the user had answered no.  */
+  WARNINGS_DENY,
+  /* Go ahead, as if the user had answered yes.  */
+  WARNINGS_ALLOW,
+  /* Remove nothing; only list what would have been asked about.  */
+  WARNINGS_REPORT
 };
 
-struct warnings_entry
+struct mount_table;
+struct rm_caches;
+struct scan_snapshot;
+
+/* A librmfd context.  Every copy of the rm_options for one removal
+   points to the same one, so that rmfd_cancel stops all the threads
+   working on it, and they count what they remove together.  */
+struct rmfd
 {
-  dev_t dev;
-  ino_t ino;
-  /* Cache the response of the user so we don't prompt for the same file
-     twice.  */
-  enum Ternary response;
-  /* The path given by the user in warn.list, used for prompting.  */
-  char given_path[1];
+  int flags;
+  struct rmfd_callbacks callbacks;
+  void *data;
+
+  /* Set by rmfd_cancel and rmfd_request_snapshot, from any thread.  */
+  volatile sig_atomic_t canceled;
+  volatile sig_atomic_t snapshot_wanted;
+
+  /* The number of files removed so far, and with RMFD_PROGRESS their
+     size, kept with stats_add for the progress callback and
+     rmfd_get_progress, which read them from any thread.  */
+  uintmax_t n_removed;
+  uintmax_t bytes_removed;
+
+  /* The directory most recently entered, in a buffer of DIR_ALLOC
+     bytes, or an empty string; protected by LOCK.  */
+  pthread_mutex_t lock;
+  char *dir;
+  size_t dir_alloc;
+
+  /* What the last removal did, with RMFD_STATS, and otherwise NULL.  */
+  struct stats *stats;
+
+  /* Where the removals are traced to, after rmfd_trace, and otherwise
+     NULL.  */
+  struct trace *trace;
+
+  /* Where root_dev_ino points, with --preserve-root.  */
+  struct dev_ino root_dev_ino;
+
+  /* The lines of warn.list, kept by rmfd --serve, or NULL to read it
+     for each removal.  */
+  struct warn_list const *warn_list;
+
+  /* What its removals have found out about the credentials of rm,
+     file systems and symbolic links, which later ones reuse.  */
+  struct rm_caches *caches;
 };
 
 struct rm_options
@@ -65,6 +113,10 @@ struct rm_options
      diagnostic comes too late -- after removing all contents.  */
   bool one_file_system;
 
+  /* If true, do not remove a command line argument that is a mount
+     point.  */
+  bool preserve_all_root;
+
   /* If true, recursively remove directories.  */
   bool recursive;
 
@@ -72,17 +124,46 @@ struct rm_options
      and preserving `/'.  Otherwise NULL.  */
   struct dev_ino *root_dev_ino;
 
-  /* If nonzero, stdin is a tty.  */
+  /* The mount points under the command line arguments, with
+     --one-file-system or --preserve-root=all.  NULL if they are not
+     needed or can't be read.  */
+  struct mount_table *mount_table;
+
+  /* If true, ask before removing a write-protected file, as when
+     stdin is a tty.  */
   bool stdin_tty;
 
-  /* If true, display the name of each file removed.  */
-  bool verbose;
+  /* How to report errors and removals, and ask questions.  */
+  struct rmfd *context;
 
   /* If not NULL, warn and prompt the user whenever any file in this table will
      be removed.  This overrides any interactive options.  The table contains
      warnings_entrys, so it is not the filename that is checked, it's the
      device and inode numbers.  Symbolic links should be dereferenced.  */
-  Hash_table *warnings_table;
+  struct warnings_table *warnings_table;
+
+  /* If true, warn and prompt the user before removing anything in a
+     directory that holds a file named PROTECT_MARKER.  */
+  bool protect_markers;
+
+  /* Whether to prompt for the warnings above, or answer them without
+     asking.  Any other way, each is also passed to the protected
+     callback.  */
+  enum warnings_policy warnings_policy;
+
+  /* If not NULL, what check found before rm started removing.  */
+  struct scan_snapshot *snapshot;
+
+  /* If true, let check start removing the subdirectories that it finds
+     nothing to warn about beneath, while it goes on checking the rest.  */
+  bool pipeline;
+
+  /* If true, leave alone, without a word, anything that would need a
+     prompt, so that a later pass can ask about it.  */
+  bool defer_prompts;
+
+  /* Set by check if removing anything during the pre-scan failed.  */
+  bool pipeline_failed;
 
   /* If true, treat the failure by the rm function to restore the
      current working directory as a fatal error.  I.e., if this field
@@ -93,6 +174,10 @@ struct rm_options
   bool require_restore_cwd;
 };
 
+/* The name of the file that marks the directory holding it as
+   protected, for --warnings.  */
+# define PROTECT_MARKER ".rmfd-protect"
+
 enum RM_status
 {
   /* These must be listed in order of increasing seriousness. */
@@ -114,8 +199,39 @@ enum RM_status
     }								\
   while (0)
 
-extern bool check_globs (char *const *file, struct rm_options const *x);
-extern bool check (char *const *file, struct rm_options const *x);
+struct glob_check;
+struct prescan;
+
+extern struct glob_check *check_globs_start (char *const *file,
+                                             struct rm_options const *x);
+extern enum RM_status check_globs_finish (struct glob_check *g,
+                                          struct rm_options const *x);
+extern void check_globs_cancel (struct glob_check *g);
+extern enum RM_status check_globs (char *const *file,
+                                   struct rm_options const *x);
+extern struct prescan *check_start (char *const *file, struct rm_options *x,
+                                    bool hold_removal);
+extern enum RM_status check_finish (struct prescan *s, struct rm_options *x);
+extern void check_cancel (struct prescan *s);
+extern enum RM_status check (char *const *file, struct rm_options *x);
 extern enum RM_status rm (char *const *file, struct rm_options const *x);
+extern void scan_snapshot_free (struct scan_snapshot *snap);
+extern struct rm_caches *rm_caches_new (void);
+extern void rm_caches_free (struct rm_caches *c);
+
+extern void lock_message (int errnum);
+extern void report_error (struct rm_options const *x, char *message);
+extern bool ask_question (struct rm_options const *x,
+                          enum rmfd_question kind, char *question);
+
+/* Report an error, as error (0, ERRNUM, FORMAT, ...) would, and ask a
+   question, through the callbacks of X.  These are macros so that the
+   arguments, quote calls and all, are evaluated with the lock that
+   lock_message takes held, since quote's buffers are shared by every
+   thread.  */
+# define rm_error(X, Errnum, ...) \
+  (lock_message (Errnum), report_error (X, xasprintf (__VA_ARGS__)))
+# define rm_ask(X, Kind, ...) \
+  (lock_message (0), ask_question (X, Kind, xasprintf (__VA_ARGS__)))
 
 #endif
@@ -0,0 +1,92 @@
+/* rm as a loadable bash builtin.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* A script that runs rm in a loop spends most of its time forking and
+   executing it.  Once loaded with `enable -f rmfd.so rm', the rm
+   command instead runs the main of rm.c in the shell, with the same
+   options, messages and exit status.
+
+   This file includes bash's headers, and none of gnulib's or rm's but
+   rm-builtin.h, since the two sets clash.  */
+
+#include "loadables.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rm-builtin.h"
+
+/* Where rm_builtin_exit returns to, and the status it was given.  */
+static jmp_buf exit_env;
+static int exit_status;
+
+void
+rm_builtin_exit (int status)
+{
+  exit_status = status;
+  longjmp (exit_env, 1);
+}
+
+int
+rm_builtin_interrupted (void)
+{
+  return interrupt_state != 0;
+}
+
+/* Run rm with the arguments in LIST, and return its exit status.  */
+static int
+rm_builtin (WORD_LIST *list)
+{
+  int argc;
+  char **argv = make_builtin_argv (list, &argc);
+
+  if (setjmp (exit_env) == 0)
+    exit_status = rm_main (argc, argv);
+  rm_builtin_reset ();
+  xfree (argv);
+
+  /* rm would report this as it exits, in close_stdout.  */
+  if (fflush (stdout) != 0)
+    {
+      builtin_error ("write error: %s", strerror (errno));
+      clearerr (stdout);
+      exit_status = EXECUTION_FAILURE;
+    }
+  return exit_status;
+}
+
+static char *rm_doc[] =
+{
+  "Remove files.",
+  "",
+  "Remove each FILE as the rm program would, with the same options",
+  "and exit status, but without starting a new process.  See",
+  "`rm --help' for the options.",
+  NULL
+};
+
+struct builtin rm_struct =
+{
+  "rm",
+  rm_builtin,
+  BUILTIN_ENABLED,
+  rm_doc,
+  "rm [OPTION]... FILE...",
+  0
+};
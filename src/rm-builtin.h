@@ -0,0 +1,39 @@
+/* rm as a loadable bash builtin.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* rm.c is compiled a second time with RMFD_BUILTIN defined, for
+   rm-builtin.c to run its main in the shell.  The two see different
+   headers, gnulib's and bash's, so nothing here may depend on
+   either.  */
+
+#ifndef RM_BUILTIN_H
+# define RM_BUILTIN_H
+
+/* The main of rm.c, which returns or calls rm_builtin_exit.  */
+extern int rm_main (int argc, char **argv);
+
+/* Return to the shell from rm_main with exit status STATUS.  */
+extern void rm_builtin_exit (int status) __attribute__ ((__noreturn__));
+
+/* Undo what rm_main left behind in the shell process, so that the next
+   command starts afresh.  */
+extern void rm_builtin_reset (void);
+
+/* Return nonzero if the user has interrupted the shell.  */
+extern int rm_builtin_interrupted (void);
+
+#endif
@@ -22,20 +22,30 @@
 
 #include <stdio.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
-#include <assert.h>
 
 #include "system.h"
 #include "argmatch.h"
-#include "concat-filename.h"
 #include "error.h"
+#include "gethrxtime.h"
+#include "human.h"
 #include "quote.h"
 #include "quotearg.h"
-#include "remove.h"
-#include "root-dev-ino.h"
+#include "rmfd.h"
+#include "xvasprintf.h"
 #include "yesno.h"
 #include "priv-set.h"
 
+#ifdef RMFD_BUILTIN
+/* Built into rmfd.so, main must return to the shell, not exit it.  */
+# include "rm-builtin.h"
+# define main rm_main
+# define exit rm_builtin_exit
+#endif
+
 /* The official name of this program (e.g., no `g' prefix).  */
 #define PROGRAM_NAME "rmfd"
 
@@ -53,9 +63,18 @@ enum
   INTERACTIVE_OPTION = CHAR_MAX + 1,
   ONE_FILE_SYSTEM,
   NO_PRESERVE_ROOT,
+  JOBS_PER_DEVICE_OPTION,
+  PIPELINE_OPTION,
   PRESERVE_ROOT,
   PRESUME_INPUT_TTY_OPTION,
-  WARNINGS
+  PRIORITY_OPTION,
+  PROGRESS_OPTION,
+  SERVE_OPTION,
+  STATS_OPTION,
+  SUBMIT_OPTION,
+  TRACE_OPTION,
+  WARNINGS,
+  WARNINGS_POLICY_OPTION
 };
 
 enum interactive_type
@@ -70,10 +89,12 @@ static struct option const long_opts[] =
   {"directory", no_argument, NULL, 'd'},
   {"force", no_argument, NULL, 'f'},
   {"interactive", optional_argument, NULL, INTERACTIVE_OPTION},
+  {"jobs-per-device", required_argument, NULL, JOBS_PER_DEVICE_OPTION},
 
   {"one-file-system", no_argument, NULL, ONE_FILE_SYSTEM},
   {"no-preserve-root", no_argument, NULL, NO_PRESERVE_ROOT},
-  {"preserve-root", no_argument, NULL, PRESERVE_ROOT},
+  {"pipeline", no_argument, NULL, PIPELINE_OPTION},
+  {"preserve-root", optional_argument, NULL, PRESERVE_ROOT},
 
   /* This is solely for testing.  Do not document.  */
   /* It is relatively difficult to ensure that there is a tty on stdin.
@@ -81,9 +102,16 @@ static struct option const long_opts[] =
      it'd be harder to test the parts of rm that depend on that setting.  */
   {"-presume-input-tty", no_argument, NULL, PRESUME_INPUT_TTY_OPTION},
 
+  {"priority", required_argument, NULL, PRIORITY_OPTION},
+  {"progress", no_argument, NULL, PROGRESS_OPTION},
   {"recursive", no_argument, NULL, 'r'},
+  {"serve", optional_argument, NULL, SERVE_OPTION},
+  {"stats", optional_argument, NULL, STATS_OPTION},
+  {"submit", optional_argument, NULL, SUBMIT_OPTION},
+  {"trace", required_argument, NULL, TRACE_OPTION},
   {"verbose", no_argument, NULL, 'v'},
   {"warnings", no_argument, NULL, 'w'},
+  {"warnings-policy", required_argument, NULL, WARNINGS_POLICY_OPTION},
   {GETOPT_HELP_OPTION_DECL},
   {GETOPT_VERSION_OPTION_DECL},
   {NULL, 0, NULL, 0}
@@ -103,6 +131,35 @@ static enum interactive_type const interactive_types[] =
 };
 ARGMATCH_VERIFY (interactive_args, interactive_types);
 
+static char const *const warnings_policy_args[] =
+{
+  "deny", "allow", "report", NULL
+};
+static int const warnings_policy_flags[] =
+{
+  RMFD_WARNINGS_DENY, RMFD_WARNINGS_ALLOW, RMFD_WARNINGS_REPORT
+};
+ARGMATCH_VERIFY (warnings_policy_args, warnings_policy_flags);
+
+/* Return the integer ARG of OPTION, which must be between MIN and MAX,
+   or die.  */
+static long int
+integer_arg (char const *option, char const *arg, long int min, long int max)
+{
+  char *end;
+  long int n;
+
+  errno = 0;
+  n = strtol (arg, &end, 10);
+  if (end == arg || *end || errno || n < min || max < n)
+    {
+      error (0, 0, _("invalid argument %s for %s"), quote (arg),
+             quote_n (1, option));
+      usage (EXIT_FAILURE);
+    }
+  return n;
+}
+
 /* Advise the user about invalid usages like "rm -foo" if the file
    "-foo" exists, assuming ARGC and ARGV are as with `main'.  */
 
@@ -130,82 +187,6 @@ diagnose_leading_hyphen (int argc, char **argv)
     }
 }
 
-static size_t
-warnings_table_hash (void const *p, size_t n_buckets)
-{
-  struct warnings_entry const *entry = p;
-  return entry->ino % n_buckets;
-}
-
-static bool
-warnings_table_comparator (void const *p1, void const *p2)
-{
-  struct warnings_entry const *e1 = p1, *e2 = p2;
-  return e1->dev == e2->dev && e1->ino == e2->ino;
-}
-
-static void
-add_warnings_entry (Hash_table *table, struct stat const *st, char const *path,
-                    size_t path_length)
-{
-  struct warnings_entry *entry = xmalloc (sizeof *entry + path_length);
-  entry->dev = st->st_dev;
-  entry->ino = st->st_ino;
-  entry->response = T_UNKNOWN;
-  strcpy(entry->given_path, path);
-  if (! hash_insert (table, entry))
-    xalloc_die ();
-}
-
-/* Create a hash table of device and inode number pairs by reading the
-   file list ~/.rmfd/warn.list.  If we can't read that file return
-   NULL.  */
-static Hash_table *
-create_warnings_table (void)
-{
-  char const *home_dir = getenv ("HOME");
-  if (! home_dir)
-    return NULL;
-
-  char *path = xconcatenated_filename (home_dir, ".rmfd/warn.list", NULL);
-  FILE *fp = fopen (path, "r");
-  if (! fp)
-    {
-      free (path);
-      return NULL;
-    }
-
-  Hash_table *table = hash_initialize (41, NULL, warnings_table_hash,
-                                       warnings_table_comparator, NULL);
-  if (! table)
-    xalloc_die ();
-
-  char *line = NULL;
-  size_t length;
-  ssize_t read;
-  while (-1 != (read = getline (&line, &length, fp)))
-    {
-      if (line[read - 1] == '\n')
-        line[--read] = '\0';
-      if (line[0] != '/')
-        error (1, 0, "warn.list: %s: must be an absolute path", quote (line));
-
-      struct stat st;
-
-      if (0 == lstat (line, &st))
-        add_warnings_entry (table, &st, line, read);
-
-      if (S_ISLNK (st.st_mode) && 0 == stat (line, &st))
-        add_warnings_entry (table, &st, line, read);
-    }
-
-  free (line);
-  fclose (fp);
-  free (path);
-
-  return table;
-}
-
 void
 usage (int status)
 {
@@ -233,14 +214,42 @@ Remove (unlink) the FILE(s).\n\
       --one-file-system  when removing a hierarchy recursively, skip any\n\
                           directory that is on a file system different from\n\
                           that of the corresponding command line argument\n\
+"), stdout);
+      fputs (_("\
+      --pipeline        with -r and --warnings, start removing each\n\
+                          subdirectory under which nothing is listed\n\
+                          or found as soon as it is checked, rather than\n\
+                          once all is checked and the prompts are answered.\n\
+                          Declining a prompt then no longer means that\n\
+                          nothing is removed, only that no protected file\n\
+                          is, nor anything that still awaits a prompt\n\
 "), stdout);
       fputs (_("\
       --no-preserve-root  do not treat `/' specially\n\
-      --preserve-root   do not remove `/' (default)\n\
+      --preserve-root[=all]  do not remove `/' (default);\n\
+                          with `all', do not remove any command line\n\
+                          argument that is a mount point\n\
+      --progress        show on stderr, every second, the files and bytes\n\
+                          removed so far, the rate, and the directory\n\
+                          being removed\n\
   -r, -R, --recursive   remove directories and their contents recursively\n\
+      --stats[=json]    when done, report on stderr how long each phase\n\
+                          took, the system calls made, and the resources\n\
+                          used, as JSON if asked\n\
+      --trace=FILE      write to FILE where the time went, as a trace\n\
+                          for chrome://tracing or Perfetto: each phase,\n\
+                          directory and prompt, and each system call\n\
+                          that took 1 ms or more\n\
   -v, --verbose         explain what is being done\n\
-  -w, --warnings        read ~/.rmfd/warn.list and issue a prompt if any\n\
-                          file in that list is going to be removed.\n\
+  -w, --warnings        read ~/.rmfd/warn.list and /etc/rmfd/warn.list,\n\
+                          and issue a prompt if any file in those lists\n\
+                          is going to be removed, or anything in a\n\
+                          directory holding a file named .rmfd-protect\n\
+      --warnings-policy=POLICY  imply --warnings, but instead of prompting,\n\
+                          list each protected file on stdout and act\n\
+                          according to POLICY: deny (as if answered no),\n\
+                          allow (as if answered yes), or report (remove\n\
+                          nothing)\n\
 "), stdout);
       fputs (HELP_OPTION_DESCRIPTION, stdout);
       fputs (VERSION_OPTION_DESCRIPTION, stdout);
@@ -248,6 +257,10 @@ Remove (unlink) the FILE(s).\n\
 \n\
 By default, rm does not remove directories.  Use the --recursive (-r or -R)\n\
 option to remove each listed directory, too, along with all of its contents.\n\
+"), stdout);
+      fputs (_("\
+\n\
+Sent the USR1 signal, rm shows once on stderr how far it has got.\n\
 "), stdout);
       printf (_("\
 \n\
@@ -269,41 +282,420 @@ assurance that the contents are truly unrecoverable, consider using shred.\n\
   exit (status);
 }
 
+/* True if -v was given.  */
+static bool verbose;
+
+/* Whether stderr is a terminal, to show warnings in color, or -1 if
+   not known yet.  */
+static int use_colors = -1;
+
+/* The removal under way, for cancel_on_interrupt and SIGUSR1.  */
+static struct rmfd *running;
+
+/* Held while writing to stdout or stderr, from the threads of librmfd
+   and the one showing --progress, and while waiting for the answer to
+   a question, so that progress is never shown in the middle of a
+   prompt or a message.  */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The width of the progress line left on stderr, a terminal, to be
+   written over, or 0 if there is none.  */
+static size_t progress_width;
+
+/* Take the progress line, if any, off stderr, with OUTPUT_LOCK held.  */
+static void
+clear_progress_line (void)
+{
+  if (progress_width)
+    {
+      fprintf (stderr, "\r%*s\r", (int) progress_width, "");
+      progress_width = 0;
+    }
+}
+
+/* Ask QUESTION, of kind KIND, on stderr, and read the answer from
+   stdin.  Each line of QUESTION but those in between starts with the
+   program name, and a warning's first one says so, in bright red if
+   stderr is a terminal.  */
+static bool
+ask (void *data ATTRIBUTE_UNUSED, enum rmfd_question kind,
+     char const *question)
+{
+  pthread_mutex_lock (&output_lock);
+  clear_progress_line ();
+  if (kind == RMFD_ASK_WARNING)
+    {
+      if (use_colors < 0)
+        use_colors = isatty (STDERR_FILENO);
+      if (use_colors)
+        fprintf (stderr, _("%s: \033[01;31mWARNING:\033[0m "), program_name);
+      else
+        fprintf (stderr, _("%s: WARNING: "), program_name);
+    }
+  else
+    fprintf (stderr, "%s: ", program_name);
+
+  char const *last_line = strrchr (question, '\n');
+  if (last_line)
+    {
+      last_line++;
+      fwrite (question, 1, last_line - question, stderr);
+      fprintf (stderr, "%s: %s", program_name, last_line);
+    }
+  else
+    fputs (question, stderr);
+  bool yes = yesno ();
+  pthread_mutex_unlock (&output_lock);
+  return yes;
+}
+
 static void
-rm_option_init (struct rm_options *x)
+report_error (void *data ATTRIBUTE_UNUSED, int errnum, char const *message)
 {
-  x->ignore_missing_files = false;
-  x->interactive = RMI_SOMETIMES;
-  x->one_file_system = false;
-  x->recursive = false;
-  x->root_dev_ino = NULL;
-  x->stdin_tty = isatty (STDIN_FILENO);
-  x->verbose = false;
-  x->warnings_table = NULL;
-
-  /* Since this program exits immediately after calling `rm', rm need not
-     expend unnecessary effort to preserve the initial working directory.  */
-  x->require_restore_cwd = false;
+  pthread_mutex_lock (&output_lock);
+  clear_progress_line ();
+  error (0, errnum, "%s", message);
+  pthread_mutex_unlock (&output_lock);
+}
+
+static void
+report_removed (void *data ATTRIBUTE_UNUSED, char const *file, bool is_dir)
+{
+  if (verbose)
+    {
+      pthread_mutex_lock (&output_lock);
+      clear_progress_line ();
+      printf ((is_dir
+               ? _("removed directory: %s\n")
+               : _("removed %s\n")), quote (file));
+      pthread_mutex_unlock (&output_lock);
+    }
+}
+
+/* List GIVEN_PATH and FILE, as a warnings policy does on stdout.  */
+static void
+report_protected (void *data ATTRIBUTE_UNUSED, char const *given_path,
+                  char const *file)
+{
+  pthread_mutex_lock (&output_lock);
+  clear_progress_line ();
+  printf ("%s\t%s\n", quotearg_n_style (0, escape_quoting_style, given_path),
+          quotearg_n_style (1, escape_quoting_style, file));
+  pthread_mutex_unlock (&output_lock);
+}
+
+/* How often --progress shows the progress line, in seconds.  */
+enum { PROGRESS_INTERVAL = 1 };
+
+/* What a progress report is for.  */
+enum progress_report
+{
+  /* The line that --progress keeps up to date.  */
+  PROGRESS_LINE,
+  /* A snapshot asked for with SIGUSR1.  */
+  PROGRESS_SNAPSHOT,
+  /* The totals, once the removal is done.  */
+  PROGRESS_TOTAL
+};
+
+/* True if --progress was given.  */
+static bool show_progress;
+
+/* When the removal started, and when the progress line was last
+   shown, with the number of files removed by then.  */
+static xtime_t progress_start;
+static xtime_t progress_time;
+static uintmax_t progress_removed;
+
+/* Set once the removal is done, to stop the thread showing the
+   progress line; protected by OUTPUT_LOCK.  */
+static bool progress_done;
+static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+
+/* Return the number of columns of the terminal on stderr.  */
+static size_t
+stderr_columns (void)
+{
+#ifdef TIOCGWINSZ
+  struct winsize ws;
+  if (ioctl (STDERR_FILENO, TIOCGWINSZ, &ws) == 0 && 0 < ws.ws_col)
+    return ws.ws_col;
+#endif
+  return 80;
+}
+
+/* Show on stderr how far the removal has got, as REPORT says, with
+   OUTPUT_LOCK held.  The counts come from rmfd_get_progress, which
+   reads them as they are, so this costs the removal nothing.  */
+static void
+report_progress (enum progress_report report)
+{
+  static struct quoting_options *dir_quoting;
+  struct rmfd_progress p;
+  char bytes[LONGEST_HUMAN_READABLE + 1];
+  xtime_t now = gethrxtime ();
+  xtime_t since = report == PROGRESS_LINE ? progress_time : progress_start;
+  uintmax_t before = report == PROGRESS_LINE ? progress_removed : 0;
+
+  rmfd_get_progress (running, &p);
+  uintmax_t per_second = (since < now
+                          ? ((double) (p.removed - before) * XTIME_PRECISION
+                             / (now - since))
+                          : 0);
+  if (report == PROGRESS_LINE)
+    {
+      progress_time = now;
+      progress_removed = p.removed;
+    }
+
+  /* The bytes are counted only with --progress.  */
+  char *counts =
+    (show_progress
+     ? xasprintf (_("removed %ju entries, %s, %ju per second"), p.removed,
+                  human_readable (p.bytes, bytes,
+                                  (human_autoscale | human_SI
+                                   | human_base_1024 | human_B),
+                                  1, 1),
+                  per_second)
+     : xasprintf (_("removed %ju entries, %ju per second"),
+                  p.removed, per_second));
+  char *line;
+  size_t dir_len = 0;
+  if (p.dir && report != PROGRESS_TOTAL)
+    {
+      /* quote is not for a thread of rm's own.  */
+      if (! dir_quoting)
+        {
+          dir_quoting = clone_quoting_options (NULL);
+          set_quoting_style (dir_quoting, locale_quoting_style);
+        }
+      char *dir = quotearg_alloc (p.dir, SIZE_MAX, dir_quoting);
+      dir_len = strlen (dir);
+      line = xasprintf ("%s: %s: %s", program_name, counts, dir);
+      free (dir);
+    }
+  else
+    line = xasprintf ("%s: %s", program_name, counts);
+  free (counts);
+  free (p.dir);
+
+  if (report == PROGRESS_LINE && isatty (STDERR_FILENO))
+    {
+      /* Keep to one line of the terminal, for \r to go back to the
+         start of, leaving out the front of the directory if need be.  */
+      size_t len = strlen (line);
+      size_t columns = stderr_columns () - 1;
+      size_t before_dir = len - dir_len;
+      if (columns < len)
+        {
+          if (dir_len && before_dir + 3 < columns)
+            {
+              char const *tail = line + len - (columns - before_dir - 3);
+              while ((*tail & 0xc0) == 0x80)
+                tail++;
+              memmove (line + before_dir + 3, tail, strlen (tail) + 1);
+              memcpy (line + before_dir, "...", 3);
+            }
+          else
+            line[columns] = '\0';
+          len = strlen (line);
+        }
+      fprintf (stderr, "\r%s%*s", line,
+               (int) (progress_width < len ? 0 : progress_width - len), "");
+      progress_width = len;
+    }
+  else
+    {
+      clear_progress_line ();
+      fprintf (stderr, "%s\n", line);
+    }
+  free (line);
+}
+
+/* Show the progress line every PROGRESS_INTERVAL, until the removal is
+   done.  */
+static void *
+show_progress_line (void *arg ATTRIBUTE_UNUSED)
+{
+  pthread_mutex_lock (&output_lock);
+  while (! progress_done)
+    {
+      struct timespec due;
+      clock_gettime (CLOCK_REALTIME, &due);
+      due.tv_sec += PROGRESS_INTERVAL;
+      if (pthread_cond_timedwait (&progress_cond, &output_lock, &due)
+          == ETIMEDOUT && ! progress_done)
+        report_progress (PROGRESS_LINE);
+    }
+  pthread_mutex_unlock (&output_lock);
+  return NULL;
+}
+
+/* Show a snapshot of the progress, which SIGUSR1 asked for, from a
+   thread of librmfd.  */
+static void
+report_snapshot (void *data ATTRIBUTE_UNUSED)
+{
+  pthread_mutex_lock (&output_lock);
+  report_progress (PROGRESS_SNAPSHOT);
+  pthread_mutex_unlock (&output_lock);
+}
+
+/* Handle SIGUSR1, which would otherwise kill rm, by having the removal
+   call report_snapshot, since nothing can be shown from here.  */
+static void
+request_snapshot (int sig ATTRIBUTE_UNUSED)
+{
+  if (running)
+    rmfd_request_snapshot (running);
+}
+
+#ifdef RMFD_BUILTIN
+# if HAVE_DECL_PROGRAM_INVOCATION_NAME
+/* The name of the shell, which set_program_name replaces with that of
+   the command, in the argv that rm_main is given.  */
+static char *shell_invocation_name;
+# endif
+
+/* Stop the removal under way once the user interrupts the shell, which
+   would otherwise wait for it to finish.  */
+static void
+cancel_on_interrupt (void *data ATTRIBUTE_UNUSED,
+                     uintmax_t n_removed ATTRIBUTE_UNUSED)
+{
+  if (rm_builtin_interrupted ())
+    rmfd_cancel (running);
+}
+
+/* xargmatch exits on an invalid argument, after saying what is valid.  */
+static void
+argmatch_exit (void)
+{
+  exit (EXIT_FAILURE);
+}
+
+void
+rm_builtin_reset (void)
+{
+  priv_set_restore_linkdir ();
+  verbose = false;
+  use_colors = -1;
+  running = NULL;
+  progress_width = 0;
+  show_progress = false;
+  progress_done = false;
+  /* Make getopt_long start over.  */
+  optind = 0;
+# if HAVE_DECL_PROGRAM_INVOCATION_NAME
+  if (shell_invocation_name)
+    program_invocation_name = shell_invocation_name;
+# endif
+}
+#else
+# define cancel_on_interrupt NULL
+#endif
+
+static struct rmfd_callbacks const callbacks =
+{
+  ask,
+  report_error,
+  report_removed,
+  cancel_on_interrupt,
+  report_protected,
+  report_snapshot
+};
+
+/* Try to remove the operands of a plain `rm [-f] FILE...', which is
+   how rm is run most of the time, with no more than an unlinkat each:
+   such a command has no need for the locale, fts, or anything else
+   that main sets up, unless something goes wrong.  Stop at the first
+   operand that can't be removed that way, e.g., a directory, so that
+   the usual code diagnoses it.  Remove the operands that were removed
+   from *ARGC and ARGV, and return true if that was all of them.  */
+static bool
+unlink_plain_operands (int *argc, char **argv)
+{
+  bool force = false;
+  bool end_of_options = false;
+  int first = 1;
+  int i;
+
+  for (; first < *argc && argv[first][0] == '-'; first++)
+    {
+      if (STREQ (argv[first], "-f") || STREQ (argv[first], "--force"))
+        force = true;
+      else if (STREQ (argv[first], "--"))
+        {
+          end_of_options = true;
+          first++;
+          break;
+        }
+      else
+        return false;
+    }
+
+  /* getopt_long would permute a later option, and without -f, rm
+     prompts before removing a write-protected file from a terminal.  */
+  if (!end_of_options)
+    for (i = first; i < *argc; i++)
+      if (argv[i][0] == '-')
+        return false;
+  if (first == *argc || (!force && isatty (STDIN_FILENO)))
+    return false;
+
+  /* Try to disable the ability to unlink a directory.  */
+  priv_set_remove_linkdir ();
+
+  for (i = first; i < *argc; i++)
+    if (! (*argv[i]
+           && (unlinkat (AT_FDCWD, argv[i], 0) == 0
+               || (force && errno == ENOENT))))
+      break;
+
+  if (i == *argc)
+    return true;
+  memmove (argv + first, argv + i, (*argc - i + 1) * sizeof *argv);
+  *argc -= i - first;
+  return false;
 }
 
 int
 main (int argc, char **argv)
 {
   bool preserve_root = true;
-  struct rm_options x;
-  bool prompt_once = false;
-  bool warnings = false;
+  int flags = 0;
+  /* Set by the options that never prompt without -f.  */
+  bool never_ask = false;
+  bool stdin_tty;
+  bool serve = false;
+  bool submit = false;
+  bool stats_json = false;
+  char const *trace_file = NULL;
+  char const *socket_name = NULL;
+  size_t jobs_per_device = 1;
+  int priority = 0;
   int c;
 
   initialize_main (&argc, &argv);
+  if (unlink_plain_operands (&argc, argv))
+    return EXIT_SUCCESS;
+
+#if defined RMFD_BUILTIN && HAVE_DECL_PROGRAM_INVOCATION_NAME
+  shell_invocation_name = program_invocation_name;
+#endif
   set_program_name (argv[0]);
+#ifdef RMFD_BUILTIN
+  /* The shell has set up the locale, and stdin is its own.  */
+  argmatch_die = argmatch_exit;
+#else
   setlocale (LC_ALL, "");
   bindtextdomain (PACKAGE, LOCALEDIR);
   textdomain (PACKAGE);
 
   atexit (close_stdin);
+#endif
 
-  rm_option_init (&x);
+  stdin_tty = isatty (STDIN_FILENO);
 
   /* Try to disable the ability to unlink a directory.  */
   priv_set_remove_linkdir ();
@@ -320,30 +712,35 @@ main (int argc, char **argv)
           break;
 
         case 'f':
-          x.interactive = RMI_NEVER;
-          x.ignore_missing_files = true;
-          prompt_once = false;
+          flags |= RMFD_FORCE;
+          flags &= ~(RMFD_INTERACTIVE | RMFD_INTERACTIVE_ONCE);
           break;
 
         case 'i':
-          x.interactive = RMI_ALWAYS;
-          x.ignore_missing_files = false;
-          prompt_once = false;
+          flags |= RMFD_INTERACTIVE;
+          flags &= ~(RMFD_FORCE | RMFD_INTERACTIVE_ONCE);
           break;
 
         case 'I':
-          x.interactive = RMI_NEVER;
-          x.ignore_missing_files = false;
-          prompt_once = true;
+          flags |= RMFD_INTERACTIVE_ONCE;
+          flags &= ~(RMFD_FORCE | RMFD_INTERACTIVE);
+          never_ask = true;
           break;
 
         case 'r':
         case 'R':
-          x.recursive = true;
+          flags |= RMFD_RECURSIVE;
           break;
 
         case 'w':
-          warnings = true;
+          flags |= RMFD_WARNINGS;
+          break;
+
+        case WARNINGS_POLICY_OPTION:
+          flags &= ~(RMFD_WARNINGS_DENY | RMFD_WARNINGS_ALLOW
+                     | RMFD_WARNINGS_REPORT);
+          flags |= XARGMATCH ("--warnings-policy", optarg,
+                              warnings_policy_args, warnings_policy_flags);
           break;
 
         case INTERACTIVE_OPTION:
@@ -357,43 +754,94 @@ main (int argc, char **argv)
             switch (i)
               {
               case interactive_never:
-                x.interactive = RMI_NEVER;
-                prompt_once = false;
+                flags &= ~(RMFD_INTERACTIVE | RMFD_INTERACTIVE_ONCE);
+                never_ask = true;
                 break;
 
               case interactive_once:
-                x.interactive = RMI_SOMETIMES;
-                x.ignore_missing_files = false;
-                prompt_once = true;
+                flags |= RMFD_INTERACTIVE_ONCE;
+                flags &= ~(RMFD_FORCE | RMFD_INTERACTIVE);
+                never_ask = false;
                 break;
 
               case interactive_always:
-                x.interactive = RMI_ALWAYS;
-                x.ignore_missing_files = false;
-                prompt_once = false;
+                flags |= RMFD_INTERACTIVE;
+                flags &= ~(RMFD_FORCE | RMFD_INTERACTIVE_ONCE);
+                never_ask = false;
                 break;
               }
             break;
           }
 
         case ONE_FILE_SYSTEM:
-          x.one_file_system = true;
+          flags |= RMFD_ONE_FILE_SYSTEM;
           break;
 
         case NO_PRESERVE_ROOT:
           preserve_root = false;
           break;
 
+        case PIPELINE_OPTION:
+          flags |= RMFD_PIPELINE;
+          break;
+
         case PRESERVE_ROOT:
+          if (optarg)
+            {
+              if (STREQ (optarg, "all"))
+                flags |= RMFD_PRESERVE_ALL_ROOT;
+              else
+                {
+                  error (0, 0, _("unrecognized --preserve-root argument: %s"),
+                         quote (optarg));
+                  exit (EXIT_FAILURE);
+                }
+            }
           preserve_root = true;
           break;
 
         case PRESUME_INPUT_TTY_OPTION:
-          x.stdin_tty = true;
+          stdin_tty = true;
+          break;
+
+        case SERVE_OPTION:
+        case SUBMIT_OPTION:
+          serve = c == SERVE_OPTION;
+          submit = !serve;
+          socket_name = optarg;
+          break;
+
+        case STATS_OPTION:
+          if (optarg && ! STREQ (optarg, "json"))
+            {
+              error (0, 0, _("unrecognized --stats argument: %s"),
+                     quote (optarg));
+              exit (EXIT_FAILURE);
+            }
+          flags |= RMFD_STATS;
+          stats_json = optarg != NULL;
+          break;
+
+        case PROGRESS_OPTION:
+          show_progress = true;
+          flags |= RMFD_PROGRESS;
+          break;
+
+        case TRACE_OPTION:
+          trace_file = optarg;
+          break;
+
+        case JOBS_PER_DEVICE_OPTION:
+          jobs_per_device = integer_arg ("--jobs-per-device", optarg,
+                                         1, INT_MAX);
+          break;
+
+        case PRIORITY_OPTION:
+          priority = integer_arg ("--priority", optarg, INT_MIN, INT_MAX);
           break;
 
         case 'v':
-          x.verbose = true;
+          verbose = true;
           break;
 
         case_GETOPT_HELP_CHAR;
@@ -404,9 +852,32 @@ main (int argc, char **argv)
         }
     }
 
+  /* These show what goes on in this process, not in the server.  */
+  char const *local_option = (flags & RMFD_STATS ? "stats"
+                              : trace_file ? "trace"
+                              : show_progress ? "progress"
+                              : NULL);
+  if ((serve || submit) && local_option)
+    {
+      error (0, 0, _("--%s cannot be used with --%s"), local_option,
+             serve ? "serve" : "submit");
+      usage (EXIT_FAILURE);
+    }
+
+  if (serve)
+    {
+      if (optind < argc)
+        {
+          error (0, 0, _("extra operand %s"), quote (argv[optind]));
+          usage (EXIT_FAILURE);
+        }
+      rmfd_serve (socket_name, jobs_per_device, &callbacks, NULL);
+      exit (EXIT_FAILURE);
+    }
+
   if (argc <= optind)
     {
-      if (x.ignore_missing_files)
+      if (flags & RMFD_FORCE)
         exit (EXIT_SUCCESS);
       else
         {
@@ -415,40 +886,77 @@ main (int argc, char **argv)
         }
     }
 
-  if (x.recursive && preserve_root)
-    {
-      static struct dev_ino dev_ino_buf;
-      x.root_dev_ino = get_root_dev_ino (&dev_ino_buf);
-      if (x.root_dev_ino == NULL)
-        error (EXIT_FAILURE, errno, _("failed to get attributes of %s"),
-               quote ("/"));
-    }
+  if (! preserve_root)
+    flags |= RMFD_NO_PRESERVE_ROOT;
+  if (stdin_tty && ! never_ask)
+    flags |= RMFD_ASK_WRITE_PROTECTED;
 
-  size_t n_files = argc - optind;
-  char **file =  argv + optind;
+  /* Without -v, spare librmfd calling report_removed for each file,
+     which also keeps it in its loop for plain rm -rf, and the server
+     sending what would not be reported.  */
+  struct rmfd_callbacks rm_callbacks = callbacks;
+  if (! verbose)
+    rm_callbacks.removed = NULL;
 
-  if (prompt_once && (x.recursive || 3 < n_files))
+  if (submit)
     {
-      fprintf (stderr,
-               (x.recursive
-                ? _("%s: remove all arguments recursively? ")
-                : _("%s: remove all arguments? ")),
-               program_name);
-      if (!yesno ())
-        exit (EXIT_SUCCESS);
+      enum rmfd_status status = rmfd_submit (socket_name, flags, priority,
+                                             &rm_callbacks, NULL,
+                                             argv + optind);
+      exit (status <= RMFD_DECLINED ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
-  if (warnings)
+  struct rmfd *ctx = rmfd_new (flags, &rm_callbacks, NULL);
+  if (trace_file && ! rmfd_trace (ctx, trace_file))
     {
-      x.warnings_table = create_warnings_table ();
-      if (x.warnings_table)
-        {
-          if (! check_globs (file, &x) || ! check (file, &x))
-            exit (EXIT_FAILURE);
-        }
+      error (0, errno, "%s", quote (trace_file));
+      rmfd_free (ctx);
+      exit (EXIT_FAILURE);
     }
-
-  enum RM_status status = rm (file, &x);
-  assert (VALID_STATUS (status));
-  exit (status == RM_ERROR ? EXIT_FAILURE : EXIT_SUCCESS);
+  running = ctx;
+
+  struct sigaction act;
+  struct sigaction old_usr1;
+  act.sa_handler = request_snapshot;
+  sigemptyset (&act.sa_mask);
+  act.sa_flags = SA_RESTART;
+  sigaction (SIGUSR1, &act, &old_usr1);
+
+  pthread_t progress_thread;
+  bool progress_thread_started = false;
+  progress_start = progress_time = gethrxtime ();
+  progress_removed = 0;
+  if (show_progress)
+    progress_thread_started = (pthread_create (&progress_thread, NULL,
+                                               show_progress_line, NULL)
+                               == 0);
+
+  enum rmfd_status status = rmfd_remove (ctx, argv + optind);
+
+  pthread_mutex_lock (&output_lock);
+  progress_done = true;
+  pthread_cond_signal (&progress_cond);
+  pthread_mutex_unlock (&output_lock);
+  if (progress_thread_started)
+    pthread_join (progress_thread, NULL);
+  sigaction (SIGUSR1, &old_usr1, NULL);
+  if (show_progress)
+    {
+      pthread_mutex_lock (&output_lock);
+      report_progress (PROGRESS_TOTAL);
+      pthread_mutex_unlock (&output_lock);
+    }
+  if (trace_file && ! rmfd_trace (ctx, NULL))
+    {
+      error (0, errno, _("error writing %s"), quote (trace_file));
+      status = RMFD_ERROR;
+    }
+  if (flags & RMFD_STATS)
+    {
+      char *report = rmfd_stats (ctx, stats_json);
+      fputs (report, stderr);
+      free (report);
+    }
+  rmfd_free (ctx);
+  exit (status <= RMFD_DECLINED ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,441 @@
+/* librmfd -- remove files as rm does, from within a program.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "system.h"
+#include "mount-table.h"
+#include "quote.h"
+#include "remove.h"
+#include "rmfd.h"
+#include "root-dev-ino.h"
+#include "stats.h"
+#include "trace.h"
+#include "warnings.h"
+#include "xvasprintf.h"
+
+/* Return a new context, which removes files as the RMFD_* FLAGS say,
+   and talks to the caller through CALLBACKS, passing them DATA.  */
+struct rmfd *
+rmfd_new (int flags, struct rmfd_callbacks const *callbacks, void *data)
+{
+  struct rmfd *ctx = xmalloc (sizeof *ctx);
+
+  if (flags & (RMFD_WARNINGS_DENY | RMFD_WARNINGS_ALLOW
+               | RMFD_WARNINGS_REPORT))
+    flags |= RMFD_WARNINGS;
+  ctx->flags = flags;
+  if (callbacks)
+    ctx->callbacks = *callbacks;
+  else
+    memset (&ctx->callbacks, 0, sizeof ctx->callbacks);
+  ctx->data = data;
+  ctx->canceled = 0;
+  ctx->snapshot_wanted = 0;
+  ctx->n_removed = 0;
+  ctx->bytes_removed = 0;
+  pthread_mutex_init (&ctx->lock, NULL);
+  ctx->dir = NULL;
+  ctx->dir_alloc = 0;
+  ctx->stats = NULL;
+  if (flags & RMFD_STATS)
+    {
+      ctx->stats = xmalloc (sizeof *ctx->stats);
+      stats_clear (ctx->stats);
+    }
+  ctx->trace = NULL;
+  ctx->warn_list = NULL;
+  ctx->caches = rm_caches_new ();
+  return ctx;
+}
+
+void
+rmfd_free (struct rmfd *ctx)
+{
+  if (ctx->trace)
+    trace_close (ctx->trace);
+  pthread_mutex_destroy (&ctx->lock);
+  rm_caches_free (ctx->caches);
+  free (ctx->dir);
+  free (ctx->stats);
+  free (ctx);
+}
+
+/* Make the rmfd_remove running with CTX, or if none is, the next one,
+   stop as soon as it can and return RMFD_CANCELED.  This may be called
+   from any thread, or from a signal handler.  A question being asked
+   is not interrupted.  */
+void
+rmfd_cancel (struct rmfd *ctx)
+{
+  ctx->canceled = 1;
+}
+
+/* Have the rmfd_remove running with CTX call the snapshot callback
+   soon, from the thread that next enters a directory or has removed
+   a thousand or so more files.  This may be called from any thread,
+   or from a signal handler.  */
+void
+rmfd_request_snapshot (struct rmfd *ctx)
+{
+  ctx->snapshot_wanted = 1;
+}
+
+/* Store in *P how far the rmfd_remove running with CTX, or else the
+   last one, has got.  This may be called from any thread, as often as
+   the caller likes, without slowing the removal down.  */
+void
+rmfd_get_progress (struct rmfd *ctx, struct rmfd_progress *p)
+{
+  p->removed = stats_get (&ctx->n_removed);
+  p->bytes = stats_get (&ctx->bytes_removed);
+  pthread_mutex_lock (&ctx->lock);
+  p->dir = ctx->dir && *ctx->dir ? xstrdup (ctx->dir) : NULL;
+  pthread_mutex_unlock (&ctx->lock);
+}
+
+/* Return a report, to be freed, of the system calls the last
+   rmfd_remove with CTX made, the time each of its phases took, and the
+   resources the process has used, in JSON if JSON, and otherwise as
+   text to show the user.  Return NULL if CTX was made without
+   RMFD_STATS.  */
+char *
+rmfd_stats (struct rmfd const *ctx, bool json)
+{
+  return ctx->stats ? stats_report (ctx->stats, json) : NULL;
+}
+
+/* Trace the removals with CTX into FILE, from now until rmfd_free, or
+   until this is called again.  The trace, in the trace event format
+   of Chrome, has a span for each phase, each directory removed, each
+   question asked, and each system call slower than TRACE_SLOW_CALL.
+   A NULL FILE just ends the trace.  Return false with errno set if
+   FILE can't be created, or the trace that ends could not all be
+   written.  */
+bool
+rmfd_trace (struct rmfd *ctx, char const *file)
+{
+  bool ok = true;
+  if (ctx->trace)
+    {
+      ok = trace_close (ctx->trace);
+      ctx->trace = NULL;
+    }
+  if (ok && file)
+    {
+      ctx->trace = trace_open (file);
+      ok = ctx->trace != NULL;
+    }
+  return ok;
+}
+
+/* When a phase was started, for --stats and the trace.  */
+struct phase_timer
+{
+  struct stats_timer stats;
+  xtime_t trace;
+};
+
+/* Start the timer *T for a phase of a removal with CTX.  */
+static void
+phase_start (struct rmfd const *ctx, struct phase_timer *t)
+{
+  stats_start (ctx->stats, &t->stats);
+  t->trace = trace_start (ctx->trace);
+}
+
+/* Count the time since *T was started toward PHASE, and trace it.  */
+static void
+phase_stop (struct rmfd *ctx, enum stats_phase phase,
+            struct phase_timer const *t)
+{
+  stats_stop (ctx->stats, phase, &t->stats);
+  trace_span (ctx->trace, TRACE_PHASE, stats_phase_name (phase), t->trace);
+}
+
+/* Set up *X for removing files as CTX says.  */
+static void
+rm_options_init (struct rm_options *x, struct rmfd *ctx)
+{
+  int flags = ctx->flags;
+
+  x->ignore_missing_files = false;
+  x->interactive = RMI_SOMETIMES;
+  if (flags & RMFD_FORCE)
+    {
+      x->interactive = RMI_NEVER;
+      x->ignore_missing_files = true;
+    }
+  if (flags & RMFD_INTERACTIVE)
+    {
+      x->interactive = RMI_ALWAYS;
+      x->ignore_missing_files = false;
+    }
+  x->one_file_system = (flags & RMFD_ONE_FILE_SYSTEM) != 0;
+  x->preserve_all_root = (flags & RMFD_PRESERVE_ALL_ROOT) != 0;
+  x->recursive = (flags & RMFD_RECURSIVE) != 0;
+  x->root_dev_ino = NULL;
+  x->mount_table = NULL;
+  x->stdin_tty = (flags & RMFD_ASK_WRITE_PROTECTED) != 0;
+  x->context = ctx;
+  x->warnings_table = NULL;
+  x->protect_markers = false;
+  x->warnings_policy = (flags & RMFD_WARNINGS_DENY ? WARNINGS_DENY
+                        : flags & RMFD_WARNINGS_ALLOW ? WARNINGS_ALLOW
+                        : flags & RMFD_WARNINGS_REPORT ? WARNINGS_REPORT
+                        : WARNINGS_ASK);
+  x->snapshot = NULL;
+  x->pipeline = (flags & RMFD_PIPELINE) != 0;
+  x->defer_prompts = false;
+  x->pipeline_failed = false;
+
+  /* Since rmfd_remove doesn't care where it leaves the working
+     directory, rm need not expend unnecessary effort to preserve it.  */
+  x->require_restore_cwd = false;
+}
+
+/* Load the warnings table for removing FILE into X->warnings_table,
+   which is left NULL if there is no warn.list, from the lines its
+   context keeps if any, and the index of the system-wide warn.list.
+   Return false if a warn.list is invalid, having said so.  */
+static bool
+load_warnings_table (char *const *file, struct rm_options *x)
+{
+  struct warn_list *read = NULL;
+  struct warn_list const *list = x->context->warn_list;
+  struct system_index *system = system_index_acquire ();
+  char const *invalid;
+  bool ok = true;
+
+  if (! list)
+    list = read = warn_list_read ();
+  x->warnings_table = NULL;
+  if (list && list->invalid_line)
+    {
+      rm_error (x, 0, _("warn.list: %s: must be an absolute path"),
+                quote (list->invalid_line));
+      ok = false;
+    }
+  else if (system && (invalid = system_index_invalid_line (system)))
+    {
+      rm_error (x, 0, _("%s: %s: must be an absolute path"),
+                system_warn_list_name (), quote (invalid));
+      ok = false;
+    }
+  else if (list || system)
+    {
+      x->warnings_table = create_warnings_table (file, list, system,
+                                                 x->context->stats);
+      system = NULL;
+    }
+  system_index_release (system);
+  warn_list_free (read);
+  return ok;
+}
+
+/* The checks for --warnings of FILE, as far as they go without asking
+   the user anything, and what they found.  */
+struct warnings_checks
+{
+  char *const *file;
+  struct rm_options *x;
+  bool ok;
+  struct glob_check *globs;
+  struct prescan *scan;
+};
+
+/* Load the warnings table and start the checks for the warnings_checks
+   ARG.  The pre-scan removes nothing before check_finish, even with
+   --pipeline, since the user may yet decline -I's prompt.  */
+static void *
+start_warnings_checks (void *arg)
+{
+  struct warnings_checks *c = arg;
+  struct rm_options *x = c->x;
+  struct rmfd *ctx = x->context;
+  struct phase_timer t;
+
+  c->globs = NULL;
+  c->scan = NULL;
+  phase_start (ctx, &t);
+  c->ok = load_warnings_table (c->file, x);
+  phase_stop (ctx, STATS_CREATE_WARNINGS_TABLE, &t);
+  if (x->warnings_table)
+    {
+      phase_start (ctx, &t);
+      c->globs = check_globs_start (c->file, x);
+      phase_stop (ctx, STATS_CHECK_GLOBS, &t);
+      phase_start (ctx, &t);
+      c->scan = check_start (c->file, x, true);
+      phase_stop (ctx, STATS_CHECK, &t);
+    }
+  return NULL;
+}
+
+/* Return the rmfd_status for the RM_status S, which rm returned, or
+   one of the checks before it if BEFORE_RM, for a removal with X.  */
+static enum rmfd_status
+rmfd_status (enum RM_status s, bool before_rm, struct rm_options const *x)
+{
+  if (x->context->canceled)
+    return RMFD_CANCELED;
+  switch (s)
+    {
+    case RM_OK:
+      return RMFD_OK;
+    case RM_USER_DECLINED:
+      return before_rm ? RMFD_PROTECTED : RMFD_DECLINED;
+    default:
+      return RMFD_ERROR;
+    }
+}
+
+/* Remove the NULL-terminated list of FILEs, as CTX says, and return
+   how it went.  */
+enum rmfd_status
+rmfd_remove (struct rmfd *ctx, char *const *file)
+{
+  struct rm_options x;
+  enum rmfd_status status;
+  size_t n_files = 0;
+  struct phase_timer t;
+
+  rm_options_init (&x, ctx);
+  ctx->n_removed = 0;
+  ctx->bytes_removed = 0;
+  pthread_mutex_lock (&ctx->lock);
+  if (ctx->dir)
+    *ctx->dir = '\0';
+  pthread_mutex_unlock (&ctx->lock);
+  if (ctx->stats)
+    stats_clear (ctx->stats);
+
+  while (file[n_files])
+    n_files++;
+
+  if (x.recursive && ! (ctx->flags & RMFD_NO_PRESERVE_ROOT))
+    {
+      x.root_dev_ino = get_root_dev_ino (&ctx->root_dev_ino);
+      if (x.root_dev_ino == NULL)
+        {
+          rm_error (&x, errno, _("failed to get attributes of %s"),
+                    quote ("/"));
+          return RMFD_ERROR;
+        }
+    }
+
+  if (x.recursive && (x.one_file_system || x.preserve_all_root))
+    x.mount_table = mount_table_load (file);
+
+  bool warnings = (ctx->flags & RMFD_WARNINGS) != 0;
+  bool ask_once = ((ctx->flags & RMFD_INTERACTIVE_ONCE)
+                   && (x.recursive || 3 < n_files));
+
+  /* Spend the time the user takes to answer -I's prompt loading the
+     warnings table and checking; if they decline, it is all dropped.  */
+  struct warnings_checks checks;
+  pthread_t checker;
+  bool checking = false;
+  if (warnings && ask_once)
+    {
+      checks.file = file;
+      checks.x = &x;
+      checking = (pthread_create (&checker, NULL, start_warnings_checks,
+                                  &checks) == 0);
+    }
+
+  bool go_ahead = (! ask_once
+                   || rm_ask (&x, RMFD_ASK_REMOVE,
+                              (x.recursive
+                               ? _("remove all arguments recursively? ")
+                               : _("remove all arguments? "))));
+
+  enum RM_status s = RM_OK;
+  if (warnings)
+    x.protect_markers = true;
+  if (checking)
+    {
+      pthread_join (checker, NULL);
+      if (! go_ahead || ! checks.ok)
+        {
+          check_globs_cancel (checks.globs);
+          check_cancel (checks.scan);
+          if (! checks.ok)
+            s = RM_ERROR;
+        }
+      else
+        {
+          phase_start (ctx, &t);
+          s = check_globs_finish (checks.globs, &x);
+          phase_stop (ctx, STATS_CHECK_GLOBS, &t);
+          /* A policy lists everything it refuses, not just the first.  */
+          if (s == RM_OK || x.warnings_policy != WARNINGS_ASK)
+            {
+              phase_start (ctx, &t);
+              enum RM_status scan_status = check_finish (checks.scan, &x);
+              phase_stop (ctx, STATS_CHECK, &t);
+              UPDATE_STATUS (s, scan_status);
+            }
+          else
+            check_cancel (checks.scan);
+        }
+    }
+  else if (warnings && go_ahead)
+    {
+      phase_start (ctx, &t);
+      bool loaded = load_warnings_table (file, &x);
+      phase_stop (ctx, STATS_CREATE_WARNINGS_TABLE, &t);
+      if (! loaded)
+        s = RM_ERROR;
+      else if (x.warnings_table)
+        {
+          phase_start (ctx, &t);
+          s = check_globs (file, &x);
+          phase_stop (ctx, STATS_CHECK_GLOBS, &t);
+          if (s == RM_OK || x.warnings_policy != WARNINGS_ASK)
+            {
+              phase_start (ctx, &t);
+              enum RM_status scan_status = check (file, &x);
+              phase_stop (ctx, STATS_CHECK, &t);
+              UPDATE_STATUS (s, scan_status);
+            }
+        }
+    }
+
+  if (! go_ahead)
+    status = RMFD_DECLINED;
+  else if (s != RM_OK)
+    status = rmfd_status (s, true, &x);
+  else if (x.warnings_policy == WARNINGS_REPORT)
+    status = RMFD_OK;
+  else
+    {
+      phase_start (ctx, &t);
+      s = rm (file, &x);
+      phase_stop (ctx, STATS_RM, &t);
+      status = rmfd_status (s, false, &x);
+    }
+
+  scan_snapshot_free (x.snapshot);
+  warnings_table_free (x.warnings_table);
+  mount_table_free (x.mount_table);
+  if (status == RMFD_CANCELED)
+    ctx->canceled = 0;
+  return status;
+}
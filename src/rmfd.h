@@ -0,0 +1,166 @@
+/* librmfd -- remove files as rm does, from within a program.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Everything rm does is done through a context, made by rmfd_new,
+   which says how to remove files and how to talk to the program doing
+   it: nothing is printed, nothing is read from stdin, and nothing
+   exits the process, except on running out of memory.  A context is
+   used by one rmfd_remove at a time, but any number of them may run
+   at once in different threads.  What a context finds out about the
+   credentials of the process and its file systems is kept until
+   rmfd_free, so a program that changes either should make a new one.  */
+
+#ifndef RMFD_H
+# define RMFD_H
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+/* How rmfd_remove went, in order of increasing seriousness.  */
+enum rmfd_status
+{
+  /* Everything was removed.  */
+  RMFD_OK,
+  /* Some files were left because a question was answered no.  */
+  RMFD_DECLINED,
+  /* Nothing was removed, since a protected file would have been and
+     that was refused, by the answer or by the warnings policy.  */
+  RMFD_PROTECTED,
+  /* Something could not be removed; the error callback was told.  */
+  RMFD_ERROR,
+  /* rmfd_cancel stopped the removal.  */
+  RMFD_CANCELED
+};
+
+/* What a question put to the ask callback is about.  */
+enum rmfd_question
+{
+  /* Whether to remove a file, descend into a directory, or go ahead
+     at all, as with -i and -I.  */
+  RMFD_ASK_REMOVE,
+  /* Whether to remove a protected file, as with -w.  */
+  RMFD_ASK_WARNING
+};
+
+/* The flags of rmfd_new, as the options of rm.  */
+enum
+{
+  /* -f: ignore nonexistent files, and never ask but for -w.  */
+  RMFD_FORCE = 1 << 0,
+  /* -i: ask before every removal.  */
+  RMFD_INTERACTIVE = 1 << 1,
+  /* -I: ask once before removing more than three files, or
+     recursively.  */
+  RMFD_INTERACTIVE_ONCE = 1 << 2,
+  /* Ask before removing a write-protected file, as rm does when its
+     stdin is a terminal.  */
+  RMFD_ASK_WRITE_PROTECTED = 1 << 3,
+  /* -r: remove directories and their contents.  */
+  RMFD_RECURSIVE = 1 << 4,
+  /* --one-file-system.  */
+  RMFD_ONE_FILE_SYSTEM = 1 << 5,
+  /* --no-preserve-root, and --preserve-root=all.  */
+  RMFD_NO_PRESERVE_ROOT = 1 << 6,
+  RMFD_PRESERVE_ALL_ROOT = 1 << 7,
+  /* -w: protect the files in ~/.rmfd/warn.list and
+     /etc/rmfd/warn.list, and directories holding a .rmfd-protect
+     file.  */
+  RMFD_WARNINGS = 1 << 8,
+  /* --warnings-policy=deny, allow or report, which imply -w.  */
+  RMFD_WARNINGS_DENY = 1 << 9,
+  RMFD_WARNINGS_ALLOW = 1 << 10,
+  RMFD_WARNINGS_REPORT = 1 << 11,
+  /* --pipeline.  */
+  RMFD_PIPELINE = 1 << 12,
+  /* --stats: count the system calls and time the phases of each
+     removal, for rmfd_stats.  */
+  RMFD_STATS = 1 << 13,
+  /* --progress: also add up the size of each file removed, for
+     rmfd_get_progress, which takes a stat of each file that fts
+     didn't stat.  */
+  RMFD_PROGRESS = 1 << 14
+};
+
+/* How a context talks to the program using it.  Each callback is
+   passed the DATA given to rmfd_new, and any of them may be NULL.
+   They may be called from threads that librmfd starts, and with
+   RMFD_PIPELINE, while ask waits for an answer.  */
+struct rmfd_callbacks
+{
+  /* Ask QUESTION, which ends in "? ", and return true if the answer is
+     yes.  A question of several lines ends with the line that asks it.
+     Without this callback, every answer is no.  */
+  bool (*ask) (void *data, enum rmfd_question kind, char const *question);
+
+  /* Report MESSAGE, followed by the description of ERRNUM unless it is
+     zero, as rm would on stderr.  */
+  void (*error) (void *data, int errnum, char const *message);
+
+  /* FILE has just been removed, and it was a directory if IS_DIR.  */
+  void (*removed) (void *data, char const *file, bool is_dir);
+
+  /* The total number of files removed so far has reached N_REMOVED.
+     This is called after each removal.  */
+  void (*progress) (void *data, uintmax_t n_removed);
+
+  /* Under a warnings policy, removing FILE would remove the protected
+     file GIVEN_PATH, as it is listed in warn.list.  */
+  void (*protected) (void *data, char const *given_path, char const *file);
+
+  /* rmfd_request_snapshot was called.  This is called soon after, from
+     a thread removing or checking files, which may call
+     rmfd_get_progress.  */
+  void (*snapshot) (void *data);
+};
+
+/* How far a removal has got, as rmfd_get_progress sees it.  */
+struct rmfd_progress
+{
+  /* The number of files removed.  */
+  uintmax_t removed;
+  /* The size in bytes of the files removed but directories, with
+     RMFD_PROGRESS, and otherwise 0.  */
+  uintmax_t bytes;
+  /* The directory most recently entered, to be freed, or NULL.  */
+  char *dir;
+};
+
+struct rmfd;
+
+extern struct rmfd *rmfd_new (int flags,
+                              struct rmfd_callbacks const *callbacks,
+                              void *data);
+extern void rmfd_free (struct rmfd *ctx);
+extern enum rmfd_status rmfd_remove (struct rmfd *ctx, char *const *file);
+extern void rmfd_cancel (struct rmfd *ctx);
+extern void rmfd_request_snapshot (struct rmfd *ctx);
+extern void rmfd_get_progress (struct rmfd *ctx, struct rmfd_progress *p);
+extern char *rmfd_stats (struct rmfd const *ctx, bool json);
+extern bool rmfd_trace (struct rmfd *ctx, char const *file);
+
+/* rm --serve: a server that keeps warn.list loaded, and runs removals
+   for rmfd_submit, one after another on each device.  A NULL
+   SOCKET_NAME means ~/.rmfd/socket.  */
+extern bool rmfd_serve (char const *socket_name, size_t jobs_per_device,
+                        struct rmfd_callbacks const *callbacks, void *data);
+extern enum rmfd_status rmfd_submit (char const *socket_name, int flags,
+                                     int priority,
+                                     struct rmfd_callbacks const *callbacks,
+                                     void *data, char *const *file);
+
+#endif
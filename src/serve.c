@@ -0,0 +1,1126 @@
+/* rm --serve and rm --submit: remove files in a long-lived server.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* A server keeps the lines of warn.list loaded, rereading them when
+   inotify says the file has changed, and runs the removals that rm
+   --submit sends it over a Unix socket: the most urgent first, and at
+   most a given number at once on each device.  Only processes of the
+   user running the server may connect.
+
+   Each connection is one job, served by a thread of its own, which
+   runs the removal in the working directory of the client, and relays
+   its callbacks to the client as messages.  A message is a type byte,
+   followed by a fixed number of fields for that type, each ended by a
+   null byte.  The client sends
+
+     'J'  version, flags, priority, wanted messages, the number of
+          files, and that many file names
+
+   with a descriptor for its working directory attached to the first
+   byte.  The server then sends any number of
+
+     'E'  errno value, message
+     'A'  rmfd_question, question; the client answers 'y' or 'n'
+     'R'  1 if a directory, file; if WANT_REMOVED
+     'P'  files removed so far; if WANT_PROGRESS
+     'W'  given path, file
+
+   and finally 'S' with the rmfd_status of the removal.  */
+
+#include <config.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#include "system.h"
+#include "concat-filename.h"
+#include "dirname.h"
+#include "quote.h"
+#include "remove.h"
+#include "rmfd.h"
+#include "stat-time.h"
+#include "warnings.h"
+#include "xvasprintf.h"
+
+enum { PROTOCOL_VERSION = 1 };
+
+/* The messages a client wants besides those it must get.  */
+enum
+{
+  WANT_REMOVED = 1 << 0,
+  WANT_PROGRESS = 1 << 1
+};
+
+/* The most files one job may name.  */
+enum { JOB_FILES_MAX = 1 << 20 };
+
+/* How often a running job checks that its client is still there, and
+   sends how far it has got, in nanoseconds.  */
+enum { CHECK_INTERVAL = 100 * 1000 * 1000 };
+
+/* The lines of warn.list as they were at some point, shared by the
+   jobs that started then.  */
+struct shared_list
+{
+  struct warn_list *list;
+  size_t refs;
+};
+
+/* A removal that a client has asked for.  */
+struct job
+{
+  /* The connection, and streams on it.  */
+  int fd;
+  FILE *in;
+  FILE *out;
+
+  /* What the client asked for.  */
+  int flags;
+  intmax_t priority;
+  int wanted;
+  char **file;
+  size_t n_files;
+  int cwd_fd;
+
+  /* The devices of the files, which the job takes a turn on.  */
+  dev_t *dev;
+  size_t n_devs;
+
+  /* The order in which the jobs came, to break ties in priority.  */
+  uintmax_t seq;
+  /* The next job in the queue.  */
+  struct job *next;
+
+  struct rmfd *ctx;
+
+  /* Protects what follows, and the order of messages to the client.  */
+  pthread_mutex_t lock;
+  /* True once the client has gone, or sent something unasked.  */
+  bool lost;
+  /* True while waiting for an answer, which is not a sign that the
+     client has gone.  */
+  bool asking;
+  struct timespec next_check;
+
+  /* Lets one question at a time wait for its answer.  */
+  pthread_mutex_t ask_lock;
+};
+
+/* How many jobs are running on a device.  */
+struct busy_device
+{
+  dev_t dev;
+  size_t n_jobs;
+};
+
+/* Everything about the server, which there is at most one of.  */
+static struct
+{
+  struct rmfd_callbacks const *callbacks;
+  void *data;
+
+  /* Protects what follows.  */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+  /* The jobs waiting for their turn, the most urgent first.  */
+  struct job *queue;
+  uintmax_t n_jobs;
+
+  struct busy_device *busy;
+  size_t n_busy;
+  size_t busy_alloc;
+  size_t jobs_per_device;
+
+  /* The lines of warn.list, and its name, or NULL if HOME is not set.  */
+  char *list_name;
+  struct shared_list *list;
+  /* True if inotify says when to reread warn.list; otherwise, it is
+     reread whenever its status has changed.  */
+  bool watching;
+  struct stat list_st;
+  bool list_exists;
+  /* Protects the three above.  */
+  pthread_mutex_t list_lock;
+
+  /* For the jobs that can't have a working directory of their own.  */
+  pthread_mutex_t cwd_lock;
+} server =
+  {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+    .list_lock = PTHREAD_MUTEX_INITIALIZER,
+    .cwd_lock = PTHREAD_MUTEX_INITIALIZER
+  };
+
+/* Report the failure of the server itself, with ERRNUM, as FORMAT
+   says.  */
+static void
+server_error (int errnum, char const *format, ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  char *message = xvasprintf (format, args);
+  va_end (args);
+  if (server.callbacks && server.callbacks->error)
+    server.callbacks->error (server.data, errnum, message);
+  free (message);
+}
+
+/* Return the socket to use, SOCKET_NAME if not NULL, or else
+   ~/.rmfd/socket.  Return NULL if HOME is not set.  */
+static char *
+socket_file_name (char const *socket_name)
+{
+  if (socket_name)
+    return xstrdup (socket_name);
+  char const *home_dir = getenv ("HOME");
+  if (! home_dir)
+    return NULL;
+  return xconcatenated_filename (home_dir, ".rmfd/socket", NULL);
+}
+
+/* Set *ADDR to the address of the socket NAME.  Return false if NAME is
+   too long for one.  */
+static bool
+socket_address (char const *name, struct sockaddr_un *addr)
+{
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  if (sizeof addr->sun_path <= strlen (name))
+    {
+      errno = ENAMETOOLONG;
+      return false;
+    }
+  strcpy (addr->sun_path, name);
+  return true;
+}
+
+/* Write the message of type TYPE with the N_FIELDS strings after
+   N_FIELDS to OUT, and flush it.  Return false if that fails.  */
+static bool
+put_message (FILE *out, char type, int n_fields, ...)
+{
+  va_list args;
+  int i;
+
+  putc (type, out);
+  va_start (args, n_fields);
+  for (i = 0; i < n_fields; i++)
+    {
+      fputs (va_arg (args, char const *), out);
+      putc ('\0', out);
+    }
+  va_end (args);
+  return fflush (out) == 0;
+}
+
+/* Read a field from IN into *FIELD, of *SIZE bytes, which getdelim may
+   reallocate.  Return false at the end of the connection.  */
+static bool
+get_field (FILE *in, char **field, size_t *size)
+{
+  return getdelim (field, size, '\0', in) != -1;
+}
+
+/* Read a field from IN that is a number, into *N.  */
+static bool
+get_number (FILE *in, intmax_t *n)
+{
+  char *field = NULL;
+  size_t size = 0;
+  char *end;
+  bool ok = false;
+
+  if (get_field (in, &field, &size) && *field)
+    {
+      errno = 0;
+      *n = strtoimax (field, &end, 10);
+      ok = (errno == 0 && *end == '\0');
+    }
+  free (field);
+  return ok;
+}
+
+/* Shared lists of warn.list.  */
+
+/* Return a new shared list of what warn.list holds now.  */
+static struct shared_list *
+read_shared_list (void)
+{
+  struct shared_list *s = xmalloc (sizeof *s);
+  s->list = warn_list_read ();
+  s->refs = 0;
+  return s;
+}
+
+/* Release a reference to S, which was taken with the server locked.  */
+static void
+release_list (struct shared_list *s)
+{
+  pthread_mutex_lock (&server.lock);
+  bool unused = --s->refs == 0 && s != server.list;
+  pthread_mutex_unlock (&server.lock);
+  if (unused)
+    {
+      warn_list_free (s->list);
+      free (s);
+    }
+}
+
+/* Make what warn.list holds now the list that jobs start with.  */
+static void
+reload_list (void)
+{
+  struct shared_list *s = read_shared_list ();
+
+  pthread_mutex_lock (&server.lock);
+  struct shared_list *old = server.list;
+  server.list = s;
+  bool unused = old->refs == 0;
+  pthread_mutex_unlock (&server.lock);
+  if (unused)
+    {
+      warn_list_free (old->list);
+      free (old);
+    }
+}
+
+/* Record the status of warn.list as of now, and return true if it is
+   not what it was the last time.  */
+static bool
+list_changed (void)
+{
+  struct stat st;
+  bool exists = stat (server.list_name, &st) == 0;
+  bool changed = (exists != server.list_exists
+                  || (exists
+                      && (st.st_dev != server.list_st.st_dev
+                          || st.st_ino != server.list_st.st_ino
+                          || st.st_size != server.list_st.st_size
+                          || (timespec_cmp (get_stat_mtime (&st),
+                                            get_stat_mtime (&server.list_st))
+                              != 0)
+                          || (timespec_cmp (get_stat_ctime (&st),
+                                            get_stat_ctime (&server.list_st))
+                              != 0))));
+  server.list_exists = exists;
+  if (exists)
+    server.list_st = st;
+  return changed;
+}
+
+/* Return a reference to the list that a job starting now must use.  */
+static struct shared_list *
+acquire_list (void)
+{
+  pthread_mutex_lock (&server.list_lock);
+  if (! server.watching && server.list_name && list_changed ())
+    reload_list ();
+  pthread_mutex_unlock (&server.list_lock);
+
+  pthread_mutex_lock (&server.lock);
+  struct shared_list *s = server.list;
+  s->refs++;
+  pthread_mutex_unlock (&server.lock);
+  return s;
+}
+
+#if HAVE_SYS_INOTIFY_H
+/* Reread warn.list whenever it changes, as the inotify descriptor ARG
+   says, which watches the directory holding it.  */
+static void *
+watch_list (void *arg)
+{
+  int fd = *(int *) arg;
+  char const *base = last_component (server.list_name);
+  union
+  {
+    struct inotify_event event;
+    char buf[sizeof (struct inotify_event) + NAME_MAX + 1];
+  } u;
+
+  while (1)
+    {
+      ssize_t n = read (fd, u.buf, sizeof u.buf);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+
+      bool reload = false;
+      bool gone = false;
+      char *p;
+      for (p = u.buf; p < u.buf + n; )
+        {
+          struct inotify_event const *e = (struct inotify_event const *) p;
+          if (e->len && STREQ (e->name, base))
+            reload = true;
+          if (e->mask & IN_IGNORED)
+            gone = true;
+          p += sizeof *e + e->len;
+        }
+      if (reload)
+        reload_list ();
+      if (gone)
+        break;
+    }
+
+  /* Without the directory to watch, go back to checking the file.  */
+  pthread_mutex_lock (&server.list_lock);
+  list_changed ();
+  server.watching = false;
+  pthread_mutex_unlock (&server.list_lock);
+  close (fd);
+  return NULL;
+}
+#endif
+
+/* Load warn.list, and start watching it for changes if possible.  */
+static void
+start_list (void)
+{
+  server.list_name = warn_list_file_name ();
+  server.watching = false;
+  server.list_exists = false;
+
+#if HAVE_SYS_INOTIFY_H
+  if (server.list_name)
+    {
+      static int fd;
+      char *dir = dir_name (server.list_name);
+      pthread_t watcher;
+
+      fd = inotify_init ();
+      if (0 <= fd
+          && 0 <= inotify_add_watch (fd, dir,
+                                     (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                                      | IN_MOVED_FROM | IN_MOVED_TO
+                                      | IN_ONLYDIR)))
+        {
+          server.watching = true;
+          if (pthread_create (&watcher, NULL, watch_list, &fd) == 0)
+            pthread_detach (watcher);
+          else
+            server.watching = false;
+        }
+      if (! server.watching && 0 <= fd)
+        close (fd);
+      free (dir);
+    }
+#endif
+
+  if (server.list_name)
+    list_changed ();
+  server.list = read_shared_list ();
+}
+
+/* The queue.  */
+
+/* Return true if jobs J1 and J2 both need a device.  */
+static bool
+share_device (struct job const *j1, struct job const *j2)
+{
+  size_t i, k;
+
+  for (i = 0; i < j1->n_devs; i++)
+    for (k = 0; k < j2->n_devs; k++)
+      if (j1->dev[i] == j2->dev[k])
+        return true;
+  return false;
+}
+
+/* Return the entry for how busy DEV is, adding it if it is new.  */
+static struct busy_device *
+busy_device (dev_t dev)
+{
+  size_t i;
+
+  for (i = 0; i < server.n_busy; i++)
+    if (server.busy[i].dev == dev)
+      return &server.busy[i];
+  if (server.n_busy == server.busy_alloc)
+    server.busy = x2nrealloc (server.busy, &server.busy_alloc,
+                              sizeof *server.busy);
+  server.busy[server.n_busy].dev = dev;
+  server.busy[server.n_busy].n_jobs = 0;
+  return &server.busy[server.n_busy++];
+}
+
+/* Return true if JOB, which is queued, may start now: each of its
+   devices has room, and no job ahead of it waits for one of them.  */
+static bool
+may_start (struct job const *job)
+{
+  struct job const *j;
+  size_t i;
+
+  for (i = 0; i < job->n_devs; i++)
+    if (server.jobs_per_device <= busy_device (job->dev[i])->n_jobs)
+      return false;
+  for (j = server.queue; j != job; j = j->next)
+    if (share_device (j, job))
+      return false;
+  return true;
+}
+
+/* Put JOB in the queue, and wait for its turn.  */
+static void
+wait_turn (struct job *job)
+{
+  struct job **p;
+  size_t i;
+
+  pthread_mutex_lock (&server.lock);
+  job->seq = server.n_jobs++;
+  for (p = &server.queue; *p && job->priority <= (*p)->priority;
+       p = &(*p)->next)
+    continue;
+  job->next = *p;
+  *p = job;
+
+  while (! may_start (job))
+    pthread_cond_wait (&server.changed, &server.lock);
+
+  for (p = &server.queue; *p != job; p = &(*p)->next)
+    continue;
+  *p = job->next;
+  for (i = 0; i < job->n_devs; i++)
+    busy_device (job->dev[i])->n_jobs++;
+  /* A job behind this one may have waited only for it to start.  */
+  pthread_cond_broadcast (&server.changed);
+  pthread_mutex_unlock (&server.lock);
+}
+
+/* Give up the turn of JOB.  */
+static void
+end_turn (struct job *job)
+{
+  size_t i;
+
+  pthread_mutex_lock (&server.lock);
+  for (i = 0; i < job->n_devs; i++)
+    busy_device (job->dev[i])->n_jobs--;
+  pthread_cond_broadcast (&server.changed);
+  pthread_mutex_unlock (&server.lock);
+}
+
+/* Set the devices of JOB to those of its files, or of its working
+   directory for a file that isn't there.  */
+static void
+find_devices (struct job *job)
+{
+  size_t i, k;
+
+  job->dev = xnmalloc (job->n_files + 1, sizeof *job->dev);
+  job->n_devs = 0;
+  for (i = 0; i <= job->n_files; i++)
+    {
+      struct stat st;
+      if (i < job->n_files
+          ? fstatat (job->cwd_fd, job->file[i], &st, AT_SYMLINK_NOFOLLOW) != 0
+          : job->n_devs != 0 || fstat (job->cwd_fd, &st) != 0)
+        continue;
+      for (k = 0; k < job->n_devs && job->dev[k] != st.st_dev; k++)
+        continue;
+      if (k == job->n_devs)
+        job->dev[job->n_devs++] = st.st_dev;
+    }
+}
+
+/* Relaying the callbacks of a job to its client.  */
+
+/* Note that the client of JOB has gone, which it has locked, and stop
+   its removal.  */
+static void
+lose_client (struct job *job)
+{
+  job->lost = true;
+  if (job->ctx)
+    rmfd_cancel (job->ctx);
+}
+
+/* Send JOB's client the message of type TYPE with the N_FIELDS strings
+   after N_FIELDS.  */
+static void
+relay (struct job *job, char type, int n_fields, char const *f1,
+       char const *f2)
+{
+  pthread_mutex_lock (&job->lock);
+  if (! job->lost && ! put_message (job->out, type, n_fields, f1, f2))
+    lose_client (job);
+  pthread_mutex_unlock (&job->lock);
+}
+
+static bool
+relay_ask (void *data, enum rmfd_question kind, char const *question)
+{
+  struct job *job = data;
+  char kind_field[INT_BUFSIZE_BOUND (int)];
+  bool yes = false;
+
+  sprintf (kind_field, "%d", (int) kind);
+  pthread_mutex_lock (&job->ask_lock);
+  pthread_mutex_lock (&job->lock);
+  bool sent = (! job->lost
+               && put_message (job->out, 'A', 2, kind_field, question));
+  if (! sent && ! job->lost)
+    lose_client (job);
+  job->asking = sent;
+  pthread_mutex_unlock (&job->lock);
+
+  if (sent)
+    {
+      int c = getc (job->in);
+      pthread_mutex_lock (&job->lock);
+      job->asking = false;
+      if (c == EOF)
+        lose_client (job);
+      yes = c == 'y';
+      pthread_mutex_unlock (&job->lock);
+    }
+  pthread_mutex_unlock (&job->ask_lock);
+  return yes;
+}
+
+static void
+relay_error (void *data, int errnum, char const *message)
+{
+  char errnum_field[INT_BUFSIZE_BOUND (int)];
+
+  sprintf (errnum_field, "%d", errnum);
+  relay (data, 'E', 2, errnum_field, message);
+}
+
+static void
+relay_removed (void *data, char const *file, bool is_dir)
+{
+  struct job *job = data;
+
+  if (job->wanted & WANT_REMOVED)
+    relay (job, 'R', 2, is_dir ? "1" : "0", file);
+}
+
+/* Every CHECK_INTERVAL, make sure the client of the job DATA is still
+   there, and tell it how many files are removed if it wants to know.
+   The client sends nothing unless asked, so anything to read means it
+   has gone.  */
+static void
+relay_progress (void *data, uintmax_t n_removed)
+{
+  struct job *job = data;
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock (&job->lock);
+  if (! job->lost && timespec_cmp (job->next_check, now) <= 0)
+    {
+      struct pollfd p;
+      p.fd = job->fd;
+      p.events = POLLIN;
+      if (! job->asking && poll (&p, 1, 0) != 0)
+        lose_client (job);
+      else if (job->wanted & WANT_PROGRESS)
+        {
+          char n_field[INT_BUFSIZE_BOUND (uintmax_t)];
+          sprintf (n_field, "%ju", n_removed);
+          if (! put_message (job->out, 'P', 1, n_field))
+            lose_client (job);
+        }
+      job->next_check = now;
+      job->next_check.tv_nsec += CHECK_INTERVAL;
+      if (1000000000 <= job->next_check.tv_nsec)
+        {
+          job->next_check.tv_sec++;
+          job->next_check.tv_nsec -= 1000000000;
+        }
+    }
+  pthread_mutex_unlock (&job->lock);
+}
+
+static void
+relay_protected (void *data, char const *given_path, char const *file)
+{
+  relay (data, 'W', 2, given_path, file);
+}
+
+static struct rmfd_callbacks const relay_callbacks =
+{
+  relay_ask,
+  relay_error,
+  relay_removed,
+  relay_progress,
+  relay_protected,
+  NULL
+};
+
+/* Serving a job.  */
+
+/* Read the request of JOB from its client.  Return false if it is not
+   a valid one.  */
+static bool
+read_request (struct job *job)
+{
+  char type;
+  union
+  {
+    struct cmsghdr header;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *c;
+
+  iov.iov_base = &type;
+  iov.iov_len = 1;
+  memset (&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  if (recvmsg (job->fd, &msg, 0) != 1 || type != 'J')
+    return false;
+  for (c = CMSG_FIRSTHDR (&msg); c; c = CMSG_NXTHDR (&msg, c))
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS
+        && c->cmsg_len == CMSG_LEN (sizeof (int)))
+      memcpy (&job->cwd_fd, CMSG_DATA (c), sizeof (int));
+  if (job->cwd_fd < 0)
+    return false;
+
+  intmax_t version, flags, wanted, n_files;
+  if (! (get_number (job->in, &version) && version == PROTOCOL_VERSION
+         && get_number (job->in, &flags)
+         && get_number (job->in, &job->priority)
+         && get_number (job->in, &wanted)
+         && get_number (job->in, &n_files)
+         && 0 <= n_files && n_files <= JOB_FILES_MAX))
+    return false;
+  job->flags = flags;
+  job->wanted = wanted;
+
+  job->file = xcalloc (n_files + 1, sizeof *job->file);
+  for (job->n_files = 0; job->n_files < n_files; job->n_files++)
+    {
+      size_t size = 0;
+      if (! get_field (job->in, &job->file[job->n_files], &size))
+        return false;
+    }
+  return true;
+}
+
+/* Run the removal of JOB in the working directory of its client.  */
+static enum rmfd_status
+run_job (struct job *job, struct shared_list *list)
+{
+  bool own_cwd = false;
+  enum rmfd_status status;
+
+#if HAVE_UNSHARE
+  /* Give this thread, and the ones it starts, a working directory of
+     their own.  */
+  own_cwd = unshare (CLONE_FS) == 0;
+#endif
+  if (! own_cwd)
+    pthread_mutex_lock (&server.cwd_lock);
+
+  job->ctx = rmfd_new (job->flags, &relay_callbacks, job);
+  job->ctx->warn_list = list->list;
+  pthread_mutex_lock (&job->lock);
+  bool lost = job->lost;
+  pthread_mutex_unlock (&job->lock);
+
+  if (lost)
+    status = RMFD_CANCELED;
+  else if (fchdir (job->cwd_fd) != 0)
+    {
+      relay_error (job, errno, _("cannot change to the working directory"));
+      status = RMFD_ERROR;
+    }
+  else
+    status = rmfd_remove (job->ctx, job->file);
+
+  if (! own_cwd)
+    pthread_mutex_unlock (&server.cwd_lock);
+  return status;
+}
+
+/* Serve the client connected on the job ARG, and free it.  */
+static void *
+serve_job (void *arg)
+{
+  struct job *job = arg;
+
+  if (read_request (job))
+    {
+      find_devices (job);
+      wait_turn (job);
+      struct shared_list *list = acquire_list ();
+
+      /* The client may have given up while the job waited.  */
+      struct pollfd p;
+      p.fd = job->fd;
+      p.events = POLLIN;
+      if (poll (&p, 1, 0) != 0)
+        job->lost = true;
+
+      enum rmfd_status status = run_job (job, list);
+      char status_field[INT_BUFSIZE_BOUND (int)];
+      sprintf (status_field, "%d", (int) status);
+      relay (job, 'S', 1, status_field, NULL);
+
+      release_list (list);
+      end_turn (job);
+      if (job->ctx)
+        rmfd_free (job->ctx);
+    }
+
+  size_t i;
+  for (i = 0; i < job->n_files; i++)
+    free (job->file[i]);
+  free (job->file);
+  free (job->dev);
+  if (0 <= job->cwd_fd)
+    close (job->cwd_fd);
+  fclose (job->in);
+  fclose (job->out);
+  pthread_mutex_destroy (&job->lock);
+  pthread_mutex_destroy (&job->ask_lock);
+  free (job);
+  return NULL;
+}
+
+/* Return true if the process at the other end of the connection FD is
+   run by the same user as the server.  */
+static bool
+same_user (int fd)
+{
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+  return (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+          && cred.uid == geteuid ());
+#else
+  /* The socket is only accessible to the user.  */
+  (void) fd;
+  return true;
+#endif
+}
+
+/* Start serving the client connected on FD.  */
+static void
+start_job (int fd)
+{
+  struct job *job = xzalloc (sizeof *job);
+  int out_fd = dup (fd);
+  pthread_t thread;
+
+  job->fd = fd;
+  job->cwd_fd = -1;
+  job->in = fdopen (fd, "r");
+  job->out = 0 <= out_fd ? fdopen (out_fd, "w") : NULL;
+  pthread_mutex_init (&job->lock, NULL);
+  pthread_mutex_init (&job->ask_lock, NULL);
+  if (! job->in || ! job->out
+      || pthread_create (&thread, NULL, serve_job, job) != 0)
+    {
+      server_error (errno, _("cannot serve a client"));
+      if (job->in)
+        fclose (job->in);
+      else
+        close (fd);
+      if (job->out)
+        fclose (job->out);
+      else if (0 <= out_fd)
+        close (out_fd);
+      pthread_mutex_destroy (&job->lock);
+      pthread_mutex_destroy (&job->ask_lock);
+      free (job);
+      return;
+    }
+  pthread_detach (thread);
+}
+
+/* Listen on SOCKET_NAME, or ~/.rmfd/socket if it is NULL, and serve
+   the removals that rmfd_submit sends there, with at most
+   JOBS_PER_DEVICE at once on any one device, until the process is
+   killed.  Report the failures of the server itself through the error
+   callback of CALLBACKS, passing it DATA, and return false if it can't
+   start.  */
+bool
+rmfd_serve (char const *socket_name, size_t jobs_per_device,
+            struct rmfd_callbacks const *callbacks, void *data)
+{
+  struct sockaddr_un addr;
+
+  server.callbacks = callbacks;
+  server.data = data;
+  server.jobs_per_device = MAX (1, jobs_per_device);
+
+  char *name = socket_file_name (socket_name);
+  if (! name)
+    {
+      server_error (0, _("HOME is not set"));
+      return false;
+    }
+  if (! socket_name)
+    {
+      char *dir = dir_name (name);
+      mkdir (dir, S_IRWXU);
+      free (dir);
+    }
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || ! socket_address (name, &addr))
+    {
+      server_error (errno, _("cannot listen on %s"), quote (name));
+      free (name);
+      return false;
+    }
+
+  /* Take over a socket that no server listens on any more.  */
+  struct stat st;
+  if (lstat (name, &st) == 0 && S_ISSOCK (st.st_mode))
+    {
+      if (connect (fd, (struct sockaddr *) &addr, sizeof addr) == 0)
+        {
+          server_error (0, _("a server is already listening on %s"),
+                        quote (name));
+          close (fd);
+          free (name);
+          return false;
+        }
+      unlink (name);
+      close (fd);
+      fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    }
+
+  mode_t old_umask = umask (S_IRWXG | S_IRWXO);
+  bool ok = (0 <= fd
+             && bind (fd, (struct sockaddr *) &addr, sizeof addr) == 0
+             && listen (fd, SOMAXCONN) == 0);
+  umask (old_umask);
+  if (! ok)
+    {
+      server_error (errno, _("cannot listen on %s"), quote (name));
+      if (0 <= fd)
+        close (fd);
+      free (name);
+      return false;
+    }
+  free (name);
+
+  /* A client that goes away must not take the server with it.  */
+  signal (SIGPIPE, SIG_IGN);
+  start_list ();
+
+  while (1)
+    {
+      int client = accept (fd, NULL, NULL);
+      if (client < 0)
+        {
+          if (errno != EINTR && errno != ECONNABORTED)
+            {
+              server_error (errno, _("accept failed"));
+              sleep (1);
+            }
+          continue;
+        }
+      if (same_user (client))
+        start_job (client);
+      else
+        close (client);
+    }
+}
+
+/* The client.  */
+
+/* Send the request to remove FILE, as FLAGS say, with PRIORITY, to the
+   server on FD, wanting the messages in WANTED.  */
+static bool
+send_request (int fd, FILE *out, int flags, int priority, int wanted,
+              char *const *file)
+{
+  int cwd_fd = open (".", O_RDONLY | O_DIRECTORY);
+  if (cwd_fd < 0)
+    return false;
+
+  char type = 'J';
+  union
+  {
+    struct cmsghdr header;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+
+  iov.iov_base = &type;
+  iov.iov_len = 1;
+  memset (&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  struct cmsghdr *c = CMSG_FIRSTHDR (&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (c), &cwd_fd, sizeof (int));
+  bool ok = sendmsg (fd, &msg, 0) == 1;
+  int saved_errno = errno;
+  close (cwd_fd);
+  errno = saved_errno;
+  if (! ok)
+    return false;
+
+  size_t n_files = 0;
+  while (file[n_files])
+    n_files++;
+  fprintf (out, "%d%c%d%c%d%c%d%c%zu%c", PROTOCOL_VERSION, '\0', flags,
+           '\0', priority, '\0', wanted, '\0', n_files, '\0');
+  for (; *file; file++)
+    {
+      fputs (*file, out);
+      putc ('\0', out);
+    }
+  return fflush (out) == 0;
+}
+
+/* Have the server listening on SOCKET_NAME, or ~/.rmfd/socket if it is
+   NULL, remove FILE as FLAGS say, in the current working directory,
+   ahead of the jobs with a lower PRIORITY.  Call CALLBACKS with DATA as
+   rmfd_remove would, as the server calls them, and return the status
+   that the server's rmfd_remove returned.  */
+enum rmfd_status
+rmfd_submit (char const *socket_name, int flags, int priority,
+             struct rmfd_callbacks const *callbacks, void *data,
+             char *const *file)
+{
+  struct sockaddr_un addr;
+  enum rmfd_status status = RMFD_ERROR;
+  char *name = socket_file_name (socket_name);
+  FILE *in = NULL;
+  FILE *out = NULL;
+  char *f1 = NULL;
+  char *f2 = NULL;
+  size_t size1 = 0;
+  size_t size2 = 0;
+  bool done = false;
+
+  if (! name)
+    {
+      if (callbacks->error)
+        callbacks->error (data, 0, _("HOME is not set"));
+      return RMFD_ERROR;
+    }
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  int out_fd = -1;
+  if (! (0 <= fd && socket_address (name, &addr)
+         && connect (fd, (struct sockaddr *) &addr, sizeof addr) == 0
+         && 0 <= (out_fd = dup (fd))
+         && (in = fdopen (fd, "r")) && (out = fdopen (out_fd, "w"))
+         && send_request (fd, out, flags, priority,
+                          ((callbacks->removed ? WANT_REMOVED : 0)
+                           | (callbacks->progress ? WANT_PROGRESS : 0)),
+                          file)))
+    {
+      if (callbacks->error)
+        {
+          char *message = xasprintf (_("cannot submit to %s"), quote (name));
+          callbacks->error (data, errno, message);
+          free (message);
+        }
+      goto out;
+    }
+
+  while (! done)
+    {
+      int type = getc (in);
+      int n_fields = (type == 'P' || type == 'S' ? 1
+                      : type == 'E' || type == 'A' || type == 'R'
+                      || type == 'W' ? 2 : -1);
+      if (n_fields < 0
+          || ! get_field (in, &f1, &size1)
+          || (n_fields == 2 && ! get_field (in, &f2, &size2)))
+        {
+          if (callbacks->error)
+            callbacks->error (data, 0, _("lost the connection to the server"));
+          break;
+        }
+
+      switch (type)
+        {
+        case 'E':
+          if (callbacks->error)
+            callbacks->error (data, atoi (f1), f2);
+          break;
+
+        case 'A':
+          {
+            bool yes = (callbacks->ask
+                        && callbacks->ask (data, atoi (f1), f2));
+            putc (yes ? 'y' : 'n', out);
+            if (fflush (out) != 0)
+              done = true;
+          }
+          break;
+
+        case 'R':
+          if (callbacks->removed)
+            callbacks->removed (data, f2, *f1 == '1');
+          break;
+
+        case 'P':
+          if (callbacks->progress)
+            callbacks->progress (data, strtoumax (f1, NULL, 10));
+          break;
+
+        case 'W':
+          if (callbacks->protected)
+            callbacks->protected (data, f1, f2);
+          break;
+
+        case 'S':
+          status = atoi (f1);
+          done = true;
+          break;
+        }
+    }
+
+ out:
+  free (f1);
+  free (f2);
+  if (in)
+    fclose (in);
+  else if (0 <= fd)
+    close (fd);
+  if (out)
+    fclose (out);
+  else if (0 <= out_fd)
+    close (out_fd);
+  free (name);
+  return status;
+}
@@ -0,0 +1,206 @@
+/* What a removal did and how long it took, for rm --stats.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "system.h"
+#include "gethrxtime.h"
+#include "stats.h"
+#include "xvasprintf.h"
+
+static char const *const phase_name[STATS_N_PHASES] =
+{
+  "create_warnings_table", "check_globs", "check", "rm"
+};
+
+static char const *const call_name[STATS_N_CALLS] =
+{
+  "fstatat", "stat", "faccessat", "unlinkat", "readdir"
+};
+
+static char const *const site_name[STATS_N_SITES] =
+{
+  "table", "globs", "prescan", "warn", "prompt", "remove"
+};
+
+/* Return the name of PHASE, as the reports have it.  */
+char const *
+stats_phase_name (enum stats_phase phase)
+{
+  return phase_name[phase];
+}
+
+/* Reset STATS, before a removal.  */
+void
+stats_clear (struct stats *stats)
+{
+  memset (stats, 0, sizeof *stats);
+}
+
+/* Return the CPU time the process has used so far, in all threads.  */
+static xtime_t
+cpu_time (void)
+{
+  struct rusage ru;
+  if (getrusage (RUSAGE_SELF, &ru) != 0)
+    return 0;
+  return (xtime_make (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec, 0)
+          + (xtime_t) (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)
+            * (XTIME_PRECISION / 1000000));
+}
+
+/* Start the timer *T for a phase, unless STATS is NULL.  */
+void
+stats_start (struct stats const *stats, struct stats_timer *t)
+{
+  if (stats)
+    {
+      t->wall = gethrxtime ();
+      t->cpu = cpu_time ();
+    }
+}
+
+/* Add the time since *T was started to PHASE in STATS, unless it is
+   NULL.  A phase may be timed in several parts, one after another.  */
+void
+stats_stop (struct stats *stats, enum stats_phase phase,
+            struct stats_timer const *t)
+{
+  if (stats)
+    {
+      stats->wall[phase] += gethrxtime () - t->wall;
+      stats->cpu[phase] += cpu_time () - t->cpu;
+    }
+}
+
+/* A string being added to.  */
+struct buffer
+{
+  char *text;
+  size_t len;
+};
+
+/* Add FORMAT, formatted as printf does, to the end of *B.  */
+static void
+append (struct buffer *b, char const *format, ...)
+{
+  va_list args;
+  va_start (args, format);
+  char *s = xvasprintf (format, args);
+  va_end (args);
+
+  size_t n = strlen (s);
+  b->text = xrealloc (b->text, b->len + n + 1);
+  memcpy (b->text + b->len, s, n + 1);
+  b->len += n;
+  free (s);
+}
+
+/* Return T, a duration, as seconds with microseconds, to be freed.  */
+static char *
+seconds (xtime_t t)
+{
+  if (t < 0)
+    t = 0;
+  return xasprintf ("%jd.%06ld", (intmax_t) xtime_sec (t),
+                    (long int) (xtime_nsec (t) / 1000));
+}
+
+/* Return a report of STATS, and of the resource usage of the process,
+   in JSON if JSON, and otherwise as a table.  */
+char *
+stats_report (struct stats const *stats, bool json)
+{
+  struct buffer b = { NULL, 0 };
+  struct rusage ru;
+  int p, s, c;
+
+  if (getrusage (RUSAGE_SELF, &ru) != 0)
+    memset (&ru, 0, sizeof ru);
+
+  xtime_t rm_wall = stats->wall[STATS_RM];
+  uintmax_t per_second = (0 < rm_wall
+                          ? (double) stats->removed * XTIME_PRECISION / rm_wall
+                          : 0);
+
+  if (json)
+    {
+      append (&b, "{\n  \"phases\": {\n");
+      for (p = 0; p < STATS_N_PHASES; p++)
+        {
+          char *wall = seconds (stats->wall[p]);
+          char *cpu = seconds (stats->cpu[p]);
+          append (&b, "    \"%s\": {\"wall\": %s, \"cpu\": %s}%s\n",
+                  phase_name[p], wall, cpu,
+                  p + 1 < STATS_N_PHASES ? "," : "");
+          free (wall);
+          free (cpu);
+        }
+      append (&b, "  },\n  \"calls\": {\n");
+      for (s = 0; s < STATS_N_SITES; s++)
+        {
+          append (&b, "    \"%s\": {", site_name[s]);
+          for (c = 0; c < STATS_N_CALLS; c++)
+            append (&b, "%s\"%s\": %ju", c ? ", " : "", call_name[c],
+                    stats->calls[s][c]);
+          append (&b, "}%s\n", s + 1 < STATS_N_SITES ? "," : "");
+        }
+      append (&b, "  },\n");
+      append (&b, "  \"entries_removed\": %ju,\n", stats->removed);
+      append (&b, "  \"entries_per_second\": %ju,\n", per_second);
+      append (&b, "  \"peak_rss_kib\": %ld,\n", (long int) ru.ru_maxrss);
+      append (&b, "  \"voluntary_context_switches\": %ld,\n",
+              (long int) ru.ru_nvcsw);
+      append (&b, "  \"involuntary_context_switches\": %ld\n}\n",
+              (long int) ru.ru_nivcsw);
+    }
+  else
+    {
+      append (&b, "%-22s %14s %14s\n", "phase", "wall s", "cpu s");
+      for (p = 0; p < STATS_N_PHASES; p++)
+        {
+          char *wall = seconds (stats->wall[p]);
+          char *cpu = seconds (stats->cpu[p]);
+          append (&b, "%-22s %14s %14s\n", phase_name[p], wall, cpu);
+          free (wall);
+          free (cpu);
+        }
+
+      append (&b, "\n%-22s", "calls");
+      for (c = 0; c < STATS_N_CALLS; c++)
+        append (&b, " %10s", call_name[c]);
+      append (&b, "\n");
+      for (s = 0; s < STATS_N_SITES; s++)
+        {
+          append (&b, "%-22s", site_name[s]);
+          for (c = 0; c < STATS_N_CALLS; c++)
+            append (&b, " %10ju", stats->calls[s][c]);
+          append (&b, "\n");
+        }
+
+      append (&b, "\nremoved %ju entries, %ju per second\n",
+              stats->removed, per_second);
+      append (&b, "peak RSS %ld KiB, %ld voluntary and %ld involuntary"
+              " context switches\n", (long int) ru.ru_maxrss,
+              (long int) ru.ru_nvcsw, (long int) ru.ru_nivcsw);
+    }
+
+  return b.text;
+}
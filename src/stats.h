@@ -0,0 +1,111 @@
+/* What a removal did and how long it took, for rm --stats.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef STATS_H
+# define STATS_H
+
+# include <stdbool.h>
+# include <stdint.h>
+# include "xtime.h"
+
+/* The phases of rmfd_remove that are timed.  */
+enum stats_phase
+{
+  STATS_CREATE_WARNINGS_TABLE,
+  STATS_CHECK_GLOBS,
+  STATS_CHECK,
+  STATS_RM,
+  STATS_N_PHASES
+};
+
+/* The system calls that are counted.  Reading a directory, through
+   opendir and readdir or through fts, counts once.  */
+enum stats_call
+{
+  STATS_FSTATAT,
+  STATS_STAT,
+  STATS_FACCESSAT,
+  STATS_UNLINKAT,
+  STATS_READDIR,
+  STATS_N_CALLS
+};
+
+/* Where they are made from.  */
+enum stats_site
+{
+  /* Loading and scanning for the warnings table.  */
+  STATS_SITE_TABLE,
+  /* check_globs.  */
+  STATS_SITE_GLOBS,
+  /* The pre-scan of check.  */
+  STATS_SITE_PRESCAN,
+  /* Looking for each file in the warnings table while removing.  */
+  STATS_SITE_WARN,
+  /* Finding out whether to prompt, as with -i.  */
+  STATS_SITE_PROMPT,
+  /* The removal itself.  */
+  STATS_SITE_REMOVE,
+  STATS_N_SITES
+};
+
+/* The counts and times of one rmfd_remove.  The counts are kept by
+   any thread working on it, and read once they all are done.  */
+struct stats
+{
+  uintmax_t calls[STATS_N_SITES][STATS_N_CALLS];
+  /* The number of files the removal itself has removed.  */
+  uintmax_t removed;
+  /* The wall clock and CPU time spent in each phase.  */
+  xtime_t wall[STATS_N_PHASES];
+  xtime_t cpu[STATS_N_PHASES];
+};
+
+/* When a phase was started.  */
+struct stats_timer
+{
+  xtime_t wall;
+  xtime_t cpu;
+};
+
+/* Add N to the counter *P, or get its value, from any thread.  Since
+   nothing is known from a counter but its value, no ordering is
+   needed.  */
+# ifdef __ATOMIC_RELAXED
+#  define stats_add(p, n) __atomic_fetch_add (p, n, __ATOMIC_RELAXED)
+#  define stats_get(p) __atomic_load_n (p, __ATOMIC_RELAXED)
+# else
+#  define stats_add(p, n) __sync_fetch_and_add (p, n)
+#  define stats_get(p) __sync_fetch_and_add (p, 0)
+# endif
+
+/* Count a call to CALL from SITE in STATS, unless it is NULL, as it is
+   without --stats.  */
+static inline void
+stats_count (struct stats *stats, enum stats_site site, enum stats_call call)
+{
+  if (stats)
+    stats_add (&stats->calls[site][call], 1);
+}
+
+extern void stats_clear (struct stats *stats);
+extern void stats_start (struct stats const *stats, struct stats_timer *t);
+extern void stats_stop (struct stats *stats, enum stats_phase phase,
+                        struct stats_timer const *t);
+extern char const *stats_phase_name (enum stats_phase phase);
+extern char *stats_report (struct stats const *stats, bool json);
+
+#endif
@@ -483,6 +483,15 @@ enum
 # define ATTRIBUTE_UNUSED __attribute__ ((__unused__))
 #endif
 
+/* The always_inline attribute appeared first in gcc-3.1.0 */
+#ifndef ATTRIBUTE_ALWAYS_INLINE
+# if __GNUC__ < 3 || (__GNUC__ == 3 && __GNUC_MINOR__ < 1)
+#  define ATTRIBUTE_ALWAYS_INLINE /* empty */
+# else
+#  define ATTRIBUTE_ALWAYS_INLINE __attribute__ ((__always_inline__))
+# endif
+#endif
+
 /* The warn_unused_result attribute appeared first in gcc-3.4.0 */
 #undef ATTRIBUTE_WARN_UNUSED_RESULT
 #if __GNUC__ < 3 || (__GNUC__ == 3 && __GNUC_MINOR__ < 4)
@@ -0,0 +1,411 @@
+/* A trace of where a removal spent its time, for rm --trace.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* The trace is written in the trace event format of Chrome, which
+   chrome://tracing and Perfetto both read: a JSON array of complete
+   events, one per span.  Each thread adds its spans to a ring buffer
+   of its own, without taking a lock, and a thread of the trace's own
+   writes them out every so often, so that the threads being traced
+   don't wait on the file.  */
+
+#include <config.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "system.h"
+#include "trace.h"
+
+/* The number of spans each thread's ring buffer holds.  A thread
+   that fills it before the writer catches up drops its spans, and the
+   trace says how many.  */
+enum { TRACE_BUFFER_SIZE = 4096 };
+
+/* How often the writer empties the ring buffers, in nanoseconds, if
+   none of them fills up by half before then.  */
+enum { TRACE_FLUSH_INTERVAL = 100000000 };
+
+/* The head of a ring buffer is stored by its thread alone, and the
+   tail by the writer alone; each loads the other's with acquire so as
+   to see the spans it stored before.  */
+#ifdef __ATOMIC_ACQUIRE
+# define load_acquire(p) __atomic_load_n (p, __ATOMIC_ACQUIRE)
+# define store_release(p, v) __atomic_store_n (p, v, __ATOMIC_RELEASE)
+#else
+# define load_acquire(p) __sync_fetch_and_add (p, 0)
+# define store_release(p, v) (__sync_synchronize (), *(p) = (v))
+#endif
+
+struct trace_event
+{
+  xtime_t start;
+  xtime_t end;
+  enum trace_category category;
+  /* The name of the span, or NULL if it is FILE.  */
+  char const *name;
+  /* The file the span is about, to be freed, or NULL.  */
+  char *file;
+};
+
+/* The ring buffer of one thread.  */
+struct trace_buffer
+{
+  struct trace_buffer *next;
+  /* The number by which the trace knows the thread.  */
+  unsigned int tid;
+  /* The spans from TAIL up to HEAD, modulo TRACE_BUFFER_SIZE, are
+     waiting for the writer.  */
+  size_t head;
+  size_t tail;
+  /* The number of spans the thread dropped.  */
+  size_t dropped;
+  /* When each directory the thread is in was entered, by level.  */
+  xtime_t *dir_start;
+  size_t dir_alloc;
+  struct trace_event event[TRACE_BUFFER_SIZE];
+};
+
+struct trace
+{
+  FILE *stream;
+  /* When the trace was opened, from which its spans are timed.  */
+  xtime_t origin;
+  pid_t pid;
+  /* Each thread's trace_buffer.  */
+  pthread_key_t key;
+  pthread_t writer;
+  /* The errno of the writer's first failure to write, or 0.  */
+  int write_errno;
+
+  /* Everything below is protected by LOCK.  */
+  pthread_mutex_t lock;
+  /* Signaled when a ring buffer is half full, or when closing.  */
+  pthread_cond_t wake;
+  /* The ring buffers, newest first.  None is taken off before
+     trace_close, so that the writer may follow NEXT without LOCK.  */
+  struct trace_buffer *buffers;
+  unsigned int n_buffers;
+  bool closing;
+};
+
+static char const *const category_name[] =
+{
+  "phase", "dir", "call", "prompt"
+};
+
+/* Write S to STREAM as a JSON string.  A byte that is not ASCII is
+   written as is, since a file name need not be in any encoding.  */
+static void
+write_string (FILE *stream, char const *s)
+{
+  unsigned char const *p;
+
+  putc ('"', stream);
+  for (p = (unsigned char const *) s; *p; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        {
+          putc ('\\', stream);
+          putc (*p, stream);
+        }
+      else if (*p < ' ')
+        fprintf (stream, "\\u%04x", *p);
+      else
+        putc (*p, stream);
+    }
+  putc ('"', stream);
+}
+
+/* Write T, a time since the trace was opened or a duration, to STREAM
+   in microseconds, as the trace event format has it.  */
+static void
+write_usec (FILE *stream, xtime_t t)
+{
+  if (t < 0)
+    t = 0;
+  fprintf (stream, "%jd.%03d", (intmax_t) (t / 1000), (int) (t % 1000));
+}
+
+/* Write the span E of the thread of B to the trace T.  */
+static void
+write_event (struct trace *t, struct trace_buffer const *b,
+             struct trace_event const *e)
+{
+  FILE *stream = t->stream;
+
+  fputs (",\n{\"name\": ", stream);
+  write_string (stream, e->name ? e->name : e->file);
+  fprintf (stream, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": ",
+           category_name[e->category]);
+  write_usec (stream, e->start - t->origin);
+  fputs (", \"dur\": ", stream);
+  write_usec (stream, e->end - e->start);
+  fprintf (stream, ", \"pid\": %ld, \"tid\": %u",
+           (long int) t->pid, b->tid);
+  if (e->name && e->file)
+    {
+      fputs (", \"args\": {\"file\": ", stream);
+      write_string (stream, e->file);
+      putc ('}', stream);
+    }
+  putc ('}', stream);
+}
+
+/* Write out, and take off, the spans waiting in B.  */
+static void
+drain (struct trace *t, struct trace_buffer *b)
+{
+  size_t head = load_acquire (&b->head);
+  size_t i;
+
+  for (i = b->tail; i != head; i++)
+    {
+      struct trace_event *e = &b->event[i % TRACE_BUFFER_SIZE];
+      write_event (t, b, e);
+      free (e->file);
+    }
+  store_release (&b->tail, head);
+}
+
+/* Write out the spans of the trace ARG as they come, until it is
+   closed, and then the last of them.  */
+static void *
+write_trace (void *arg)
+{
+  struct trace *t = arg;
+  bool closing;
+
+  do
+    {
+      struct timespec due;
+      clock_gettime (CLOCK_REALTIME, &due);
+      due.tv_nsec += TRACE_FLUSH_INTERVAL;
+      if (1000000000 <= due.tv_nsec)
+        {
+          due.tv_sec++;
+          due.tv_nsec -= 1000000000;
+        }
+
+      pthread_mutex_lock (&t->lock);
+      if (! t->closing)
+        pthread_cond_timedwait (&t->wake, &t->lock, &due);
+      closing = t->closing;
+      struct trace_buffer *b = t->buffers;
+      pthread_mutex_unlock (&t->lock);
+
+      for (; b; b = b->next)
+        drain (t, b);
+      if (fflush (t->stream) != 0 && ! t->write_errno)
+        t->write_errno = errno;
+    }
+  while (! closing);
+
+  return NULL;
+}
+
+/* Start a trace into FILE, and return it.  Return NULL with errno set
+   if FILE can't be created.  */
+struct trace *
+trace_open (char const *file)
+{
+  struct trace *t = xmalloc (sizeof *t);
+  int err;
+
+  t->stream = fopen (file, "w");
+  if (! t->stream)
+    {
+      free (t);
+      return NULL;
+    }
+  t->origin = gethrxtime ();
+  t->pid = getpid ();
+  t->buffers = NULL;
+  t->n_buffers = 0;
+  t->closing = false;
+  t->write_errno = 0;
+  fprintf (t->stream, "[\n{\"name\": \"process_name\", \"ph\": \"M\","
+           " \"pid\": %ld, \"args\": {\"name\": \"rm\"}}",
+           (long int) t->pid);
+
+  if ((err = pthread_key_create (&t->key, NULL)) != 0)
+    goto fail;
+  pthread_mutex_init (&t->lock, NULL);
+  pthread_cond_init (&t->wake, NULL);
+  if ((err = pthread_create (&t->writer, NULL, write_trace, t)) != 0)
+    {
+      pthread_cond_destroy (&t->wake);
+      pthread_mutex_destroy (&t->lock);
+      pthread_key_delete (t->key);
+      goto fail;
+    }
+  return t;
+
+ fail:
+  fclose (t->stream);
+  unlink (file);
+  free (t);
+  errno = err;
+  return NULL;
+}
+
+/* Finish the trace T, once no thread adds to it any more, and free it.
+   Return false with errno set if it could not all be written.  */
+bool
+trace_close (struct trace *t)
+{
+  struct trace_buffer *b;
+  uintmax_t dropped = 0;
+
+  pthread_mutex_lock (&t->lock);
+  t->closing = true;
+  pthread_cond_signal (&t->wake);
+  pthread_mutex_unlock (&t->lock);
+  pthread_join (t->writer, NULL);
+
+  for (b = t->buffers; b; b = b->next)
+    dropped += b->dropped;
+  if (dropped)
+    {
+      fprintf (t->stream, ",\n{\"name\": \"dropped\", \"ph\": \"i\","
+               " \"s\": \"g\", \"ts\": ");
+      write_usec (t->stream, gethrxtime () - t->origin);
+      fprintf (t->stream, ", \"pid\": %ld, \"args\": {\"spans\": %ju}}",
+               (long int) t->pid, dropped);
+    }
+  fputs ("\n]\n", t->stream);
+
+  bool ok = ! ferror (t->stream);
+  if (fclose (t->stream) != 0)
+    ok = false;
+  else if (! ok)
+    errno = t->write_errno ? t->write_errno : EIO;
+
+  while ((b = t->buffers))
+    {
+      t->buffers = b->next;
+      free (b->dir_start);
+      free (b);
+    }
+  pthread_key_delete (t->key);
+  pthread_cond_destroy (&t->wake);
+  pthread_mutex_destroy (&t->lock);
+  free (t);
+  return ok;
+}
+
+/* Return the ring buffer of the calling thread in T, starting one the
+   first time.  */
+static struct trace_buffer *
+thread_buffer (struct trace *t)
+{
+  struct trace_buffer *b = pthread_getspecific (t->key);
+
+  if (! b)
+    {
+      b = xmalloc (sizeof *b);
+      b->head = b->tail = b->dropped = 0;
+      b->dir_start = NULL;
+      b->dir_alloc = 0;
+      pthread_mutex_lock (&t->lock);
+      b->tid = ++t->n_buffers;
+      b->next = t->buffers;
+      t->buffers = b;
+      pthread_mutex_unlock (&t->lock);
+      pthread_setspecific (t->key, b);
+    }
+  return b;
+}
+
+/* Add a span of CATEGORY from START until now to T, named NAME, or
+   FILE if NAME is NULL, about FILE unless it is NULL.  */
+static void
+add_span (struct trace *t, enum trace_category category, char const *name,
+          char const *file, xtime_t start)
+{
+  struct trace_buffer *b = thread_buffer (t);
+  xtime_t end = gethrxtime ();
+  size_t head = b->head;
+  size_t tail = load_acquire (&b->tail);
+
+  if (head - tail == TRACE_BUFFER_SIZE)
+    {
+      b->dropped++;
+      return;
+    }
+
+  struct trace_event *e = &b->event[head % TRACE_BUFFER_SIZE];
+  e->start = start;
+  e->end = end;
+  e->category = category;
+  e->name = name;
+  e->file = file ? xstrdup (file) : NULL;
+  store_release (&b->head, head + 1);
+
+  /* The lock is not needed to signal, and the writer looks at the
+     buffer again at the latest after TRACE_FLUSH_INTERVAL anyway.  */
+  if (head + 1 - tail == TRACE_BUFFER_SIZE / 2)
+    pthread_cond_signal (&t->wake);
+}
+
+/* Add a span of CATEGORY named NAME, from START until now, to T
+   unless it is NULL.  */
+void
+trace_span (struct trace *t, enum trace_category category, char const *name,
+            xtime_t start)
+{
+  if (t)
+    add_span (t, category, name, NULL, start);
+}
+
+/* Add to T, unless it is NULL, the system call CALL on FILE, made at
+   START, if it took at least TRACE_SLOW_CALL.  */
+void
+trace_call (struct trace *t, char const *call, char const *file,
+            xtime_t start)
+{
+  if (t && TRACE_SLOW_CALL <= gethrxtime () - start)
+    add_span (t, TRACE_CALL, call, file, start);
+}
+
+/* Note in T, unless it is NULL, that the calling thread enters a
+   directory at LEVEL of an fts traversal.  */
+void
+trace_dir_enter (struct trace *t, size_t level)
+{
+  if (t)
+    {
+      struct trace_buffer *b = thread_buffer (t);
+      while (b->dir_alloc <= level)
+        b->dir_start = x2nrealloc (b->dir_start, &b->dir_alloc,
+                                   sizeof *b->dir_start);
+      b->dir_start[level] = gethrxtime ();
+    }
+}
+
+/* Add to T, unless it is NULL, a span for the directory DIR at LEVEL,
+   which the calling thread is done with, since it entered it.  */
+void
+trace_dir_leave (struct trace *t, size_t level, char const *dir)
+{
+  if (t)
+    {
+      struct trace_buffer *b = thread_buffer (t);
+      if (level < b->dir_alloc)
+        add_span (t, TRACE_DIR, NULL, dir, b->dir_start[level]);
+    }
+}
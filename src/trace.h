@@ -0,0 +1,61 @@
+/* A trace of where a removal spent its time, for rm --trace.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef TRACE_H
+# define TRACE_H
+
+# include <stdbool.h>
+# include <stddef.h>
+# include "gethrxtime.h"
+
+/* The kinds of span in a trace.  */
+enum trace_category
+{
+  /* A phase of rmfd_remove, as timed for --stats.  */
+  TRACE_PHASE,
+  /* A directory, from fts's FTS_D for it to its FTS_DP.  */
+  TRACE_DIR,
+  /* A system call that took at least TRACE_SLOW_CALL.  */
+  TRACE_CALL,
+  /* A question, from asking it to the answer.  */
+  TRACE_PROMPT
+};
+
+/* A system call is traced if it takes at least this long, in
+   nanoseconds.  The quick ones would only bury the slow.  */
+enum { TRACE_SLOW_CALL = 1000000 };
+
+struct trace;
+
+/* Return the time a span starts, if T is tracing, and otherwise 0
+   without looking at the clock.  */
+static inline xtime_t
+trace_start (struct trace const *t)
+{
+  return t ? gethrxtime () : 0;
+}
+
+extern struct trace *trace_open (char const *file);
+extern bool trace_close (struct trace *t);
+extern void trace_span (struct trace *t, enum trace_category category,
+                        char const *name, xtime_t start);
+extern void trace_call (struct trace *t, char const *call, char const *file,
+                        xtime_t start);
+extern void trace_dir_enter (struct trace *t, size_t level);
+extern void trace_dir_leave (struct trace *t, size_t level, char const *dir);
+
+#endif
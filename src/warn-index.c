@@ -0,0 +1,662 @@
+/* warn-index.c -- a prebuilt index of a warn.list, shared through memory
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Loading a warn.list costs a parse of every line, and a stat of many
+   of the files.  For the system-wide list, which every rm reads, one
+   process does that instead, and writes what it found to a file in
+   shared memory that the others map as it is: the device and inode
+   numbers of the listed files, in a hash table laid out as a
+   dev_ino_table is, and the lines sorted by where the files are, so
+   that the few under the operands can be found without looking at the
+   others.
+
+   The file is written under a temporary name and renamed into place,
+   so a reader sees a whole index or none, and nothing in it changes
+   once written; readers need no lock.  It names the list it was made
+   from by device and inode number, and records the size and times the
+   list had, so an index that is out of date goes unused.  Only an index
+   owned by the owner of the list, or by root, is trusted.
+
+   An index is also used without a file, by a process that can't read
+   or write one: it then builds it in its own memory.  */
+
+#include <config.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "system.h"
+#include "dev-ino-table.h"
+#include "full-write.h"
+#include "stat-time.h"
+#include "warn-index.h"
+#include "xvasprintf.h"
+
+/* Where the index files are kept.  */
+#ifndef WARN_INDEX_DIR
+# define WARN_INDEX_DIR "/dev/shm"
+#endif
+
+enum { WARN_INDEX_VERSION = 1 };
+static char const warn_index_magic[8] = "rmfdwidx";
+
+/* The layout of an index.  Every section starts on an 8-byte boundary,
+   at the offset from the start of the file given in the header, and
+   strings are given by their offset in the string section.  */
+struct index_header
+{
+  char magic[8];
+  uint64_t version;
+  uint64_t size;
+
+  /* The status of the list this was made from.  */
+  uint64_t list_dev;
+  uint64_t list_ino;
+  uint64_t list_size;
+  int64_t list_mtime[2];
+  int64_t list_ctime[2];
+
+  /* The protected files, the N_DIRS directories first.  */
+  uint64_t records;
+  uint64_t n_records;
+  uint64_t n_dirs;
+  /* The hash table of the records, with N_SLOTS a power of two, and its
+     prefilter.  */
+  uint64_t slots;
+  uint64_t n_slots;
+  uint64_t filter;
+  uint64_t n_filter_blocks;
+  /* The lines that are file names, each under the canonical name of the
+     file, sorted by that name.  */
+  uint64_t keys;
+  uint64_t n_keys;
+  /* The lines with glob patterns.  */
+  uint64_t globs;
+  uint64_t n_globs;
+  /* The first line that is not an absolute file name, or 0.  */
+  uint64_t invalid_line;
+  uint64_t strings;
+  uint64_t strings_size;
+};
+
+struct index_record
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t given_path;
+};
+
+struct index_slot
+{
+  uint64_t dev;
+  uint64_t ino;
+  /* The record stored here plus one, or 0 for an empty slot.  */
+  uint64_t record;
+};
+
+struct index_key
+{
+  uint64_t key;
+  uint64_t given_path;
+};
+
+struct warn_index
+{
+  /* The index, mapped from a file if MAPPED.  */
+  char *base;
+  size_t size;
+  bool mapped;
+
+  struct index_header const *header;
+  struct index_record const *record;
+  struct index_slot const *slot;
+  struct dev_ino_filter_block const *filter;
+  struct index_key const *key;
+  uint64_t const *glob;
+  char const *strings;
+};
+
+/* What will go in an index, as it is gathered.  */
+struct builder_record
+{
+  dev_t dev;
+  ino_t ino;
+  bool is_dir;
+  char *given_path;
+  /* The number of records added before this one.  */
+  size_t order;
+};
+
+struct builder_key
+{
+  char *key;
+  char *given_path;
+};
+
+struct warn_index_builder
+{
+  struct stat list_st;
+  struct builder_record *record;
+  size_t n_records;
+  size_t records_alloc;
+  struct builder_key *key;
+  size_t n_keys;
+  size_t keys_alloc;
+  char **glob;
+  size_t n_globs;
+  size_t globs_alloc;
+  char *invalid_line;
+};
+
+struct warn_index_builder *
+warn_index_builder_new (struct stat const *list_st)
+{
+  struct warn_index_builder *b = xzalloc (sizeof *b);
+  b->list_st = *list_st;
+  return b;
+}
+
+/* Add the file with status *ST, listed as GIVEN_PATH.  */
+void
+warn_index_add_record (struct warn_index_builder *b, struct stat const *st,
+                       char const *given_path)
+{
+  if (b->n_records == b->records_alloc)
+    b->record = x2nrealloc (b->record, &b->records_alloc, sizeof *b->record);
+  b->record[b->n_records].dev = st->st_dev;
+  b->record[b->n_records].ino = st->st_ino;
+  b->record[b->n_records].is_dir = S_ISDIR (st->st_mode) != 0;
+  b->record[b->n_records].given_path = xstrdup (given_path);
+  b->record[b->n_records].order = b->n_records;
+  b->n_records++;
+}
+
+/* Add the line GIVEN_PATH, naming the file whose canonical name is
+   KEY.  */
+void
+warn_index_add_key (struct warn_index_builder *b, char const *key,
+                    char const *given_path)
+{
+  if (b->n_keys == b->keys_alloc)
+    b->key = x2nrealloc (b->key, &b->keys_alloc, sizeof *b->key);
+  b->key[b->n_keys].key = xstrdup (key);
+  b->key[b->n_keys].given_path = xstrdup (given_path);
+  b->n_keys++;
+}
+
+/* Add the line GIVEN_PATH, which has glob patterns.  */
+void
+warn_index_add_glob (struct warn_index_builder *b, char const *given_path)
+{
+  if (b->n_globs == b->globs_alloc)
+    b->glob = x2nrealloc (b->glob, &b->globs_alloc, sizeof *b->glob);
+  b->glob[b->n_globs++] = xstrdup (given_path);
+}
+
+void
+warn_index_set_invalid_line (struct warn_index_builder *b, char const *line)
+{
+  free (b->invalid_line);
+  b->invalid_line = xstrdup (line);
+}
+
+static int
+compare_keys (void const *a, void const *b)
+{
+  struct builder_key const *k1 = a;
+  struct builder_key const *k2 = b;
+  return strcmp (k1->key, k2->key);
+}
+
+/* Directories first, in the order they were added.  */
+static int
+compare_records (void const *a, void const *b)
+{
+  struct builder_record const *r1 = a;
+  struct builder_record const *r2 = b;
+  if (r1->is_dir != r2->is_dir)
+    return r1->is_dir ? -1 : 1;
+  return r1->order < r2->order ? -1 : r1->order > r2->order;
+}
+
+/* The strings of an index, as they are gathered.  */
+struct string_pool
+{
+  char *data;
+  size_t size;
+  size_t alloc;
+};
+
+static uint64_t
+add_string (struct string_pool *pool, char const *s)
+{
+  size_t len = strlen (s) + 1;
+  uint64_t offset = pool->size;
+  while (pool->alloc - pool->size < len)
+    pool->data = x2realloc (pool->data, &pool->alloc);
+  memcpy (pool->data + pool->size, s, len);
+  pool->size += len;
+  return offset;
+}
+
+/* Set the pointers of INDEX to the sections its header gives.  */
+static void
+set_sections (struct warn_index *index)
+{
+  struct index_header const *h = (struct index_header const *) index->base;
+  index->header = h;
+  index->record = (struct index_record const *) (index->base + h->records);
+  index->slot = (struct index_slot const *) (index->base + h->slots);
+  index->filter =
+    (struct dev_ino_filter_block const *) (index->base + h->filter);
+  index->key = (struct index_key const *) (index->base + h->keys);
+  index->glob = (uint64_t const *) (index->base + h->globs);
+  index->strings = index->base + h->strings;
+}
+
+static size_t
+align8 (size_t n)
+{
+  return (n + 7) & ~(size_t) 7;
+}
+
+/* Lay out what B gathered as an index in memory, and free B.  */
+struct warn_index *
+warn_index_finish (struct warn_index_builder *b)
+{
+  struct string_pool pool = { NULL, 0, 0 };
+  struct index_header h;
+  size_t i;
+
+  /* Give each file one record, that of the first line naming it.  */
+  qsort (b->record, b->n_records, sizeof *b->record, compare_records);
+  struct dev_ino_table *seen = dev_ino_table_create ();
+  size_t n_records = 0;
+  size_t n_dirs = 0;
+  for (i = 0; i < b->n_records; i++)
+    {
+      struct builder_record *r = &b->record[i];
+      if (dev_ino_table_insert (seen, r->dev, r->ino, r) == r)
+        {
+          n_dirs += r->is_dir;
+          b->record[n_records++] = *r;
+        }
+      else
+        free (r->given_path);
+    }
+  dev_ino_table_free (seen);
+  qsort (b->key, b->n_keys, sizeof *b->key, compare_keys);
+
+  size_t n_slots = 64;
+  while (n_slots / 2 <= n_records)
+    n_slots *= 2;
+  size_t n_filter_blocks = MAX (1, n_slots / 64);
+
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, warn_index_magic, sizeof h.magic);
+  h.version = WARN_INDEX_VERSION;
+  h.list_dev = b->list_st.st_dev;
+  h.list_ino = b->list_st.st_ino;
+  h.list_size = b->list_st.st_size;
+  h.list_mtime[0] = get_stat_mtime (&b->list_st).tv_sec;
+  h.list_mtime[1] = get_stat_mtime (&b->list_st).tv_nsec;
+  h.list_ctime[0] = get_stat_ctime (&b->list_st).tv_sec;
+  h.list_ctime[1] = get_stat_ctime (&b->list_st).tv_nsec;
+  h.n_records = n_records;
+  h.n_dirs = n_dirs;
+  h.n_slots = n_slots;
+  h.n_filter_blocks = n_filter_blocks;
+  h.n_keys = b->n_keys;
+  h.n_globs = b->n_globs;
+
+  h.records = align8 (sizeof h);
+  h.slots = h.records + n_records * sizeof (struct index_record);
+  h.filter = h.slots + n_slots * sizeof (struct index_slot);
+  h.keys = h.filter + n_filter_blocks * sizeof (struct dev_ino_filter_block);
+  h.globs = h.keys + b->n_keys * sizeof (struct index_key);
+  h.strings = h.globs + b->n_globs * sizeof (uint64_t);
+
+  /* Offset 0 of the strings is the empty string, for no invalid line.  */
+  add_string (&pool, "");
+  if (b->invalid_line)
+    h.invalid_line = add_string (&pool, b->invalid_line);
+
+  struct index_record *record = xnmalloc (MAX (1, n_records), sizeof *record);
+  struct index_slot *slot = xcalloc (n_slots, sizeof *slot);
+  struct dev_ino_filter_block *filter =
+    xcalloc (n_filter_blocks, sizeof *filter);
+  for (i = 0; i < n_records; i++)
+    {
+      struct builder_record *r = &b->record[i];
+      uint64_t hash = dev_ino_hash (r->dev, r->ino);
+      size_t k;
+
+      record[i].dev = r->dev;
+      record[i].ino = r->ino;
+      record[i].given_path = add_string (&pool, r->given_path);
+      for (k = hash & (n_slots - 1); slot[k].record; k = (k + 1) & (n_slots - 1))
+        continue;
+      slot[k].dev = r->dev;
+      slot[k].ino = r->ino;
+      slot[k].record = i + 1;
+      dev_ino_filter_set (filter, n_filter_blocks, hash);
+      free (r->given_path);
+    }
+
+  struct index_key *key = xnmalloc (MAX (1, b->n_keys), sizeof *key);
+  for (i = 0; i < b->n_keys; i++)
+    {
+      key[i].key = add_string (&pool, b->key[i].key);
+      key[i].given_path = add_string (&pool, b->key[i].given_path);
+      free (b->key[i].key);
+      free (b->key[i].given_path);
+    }
+
+  uint64_t *glob = xnmalloc (MAX (1, b->n_globs), sizeof *glob);
+  for (i = 0; i < b->n_globs; i++)
+    {
+      glob[i] = add_string (&pool, b->glob[i]);
+      free (b->glob[i]);
+    }
+
+  h.strings_size = pool.size;
+  h.size = align8 (h.strings + pool.size);
+
+  struct warn_index *index = xmalloc (sizeof *index);
+  index->size = h.size;
+  index->base = xzalloc (h.size);
+  index->mapped = false;
+  memcpy (index->base, &h, sizeof h);
+  memcpy (index->base + h.records, record, n_records * sizeof *record);
+  memcpy (index->base + h.slots, slot, n_slots * sizeof *slot);
+  memcpy (index->base + h.filter, filter, n_filter_blocks * sizeof *filter);
+  memcpy (index->base + h.keys, key, b->n_keys * sizeof *key);
+  memcpy (index->base + h.globs, glob, b->n_globs * sizeof *glob);
+  memcpy (index->base + h.strings, pool.data, pool.size);
+  set_sections (index);
+
+  free (record);
+  free (slot);
+  free (filter);
+  free (key);
+  free (glob);
+  free (pool.data);
+  free (b->record);
+  free (b->key);
+  free (b->glob);
+  free (b->invalid_line);
+  free (b);
+  return index;
+}
+
+/* Return the name of the index file for the list with status
+   *LIST_ST.  */
+char *
+warn_index_file_name (struct stat const *list_st)
+{
+  return xasprintf ("%s/rmfd-warn-%ju-%ju.index", WARN_INDEX_DIR,
+                    (uintmax_t) list_st->st_dev,
+                    (uintmax_t) list_st->st_ino);
+}
+
+/* Return true if INDEX was made from the list with status *LIST_ST as
+   it is now.  */
+bool
+warn_index_is_for (struct warn_index const *index, struct stat const *list_st)
+{
+  struct index_header const *h = index->header;
+  struct timespec mtime = get_stat_mtime (list_st);
+  struct timespec ctime = get_stat_ctime (list_st);
+
+  return (h->list_dev == (uint64_t) list_st->st_dev
+          && h->list_ino == (uint64_t) list_st->st_ino
+          && h->list_size == (uint64_t) list_st->st_size
+          && h->list_mtime[0] == mtime.tv_sec
+          && h->list_mtime[1] == mtime.tv_nsec
+          && h->list_ctime[0] == ctime.tv_sec
+          && h->list_ctime[1] == ctime.tv_nsec);
+}
+
+/* Return true if the N elements of SIZE bytes at OFFSET are within an
+   index of INDEX_SIZE bytes.  */
+static bool
+section_fits (uint64_t offset, uint64_t n, size_t size, size_t index_size)
+{
+  return (offset % 8 == 0 && offset <= index_size
+          && n <= (index_size - offset) / size);
+}
+
+/* Return true if the header H of an index of SIZE bytes is sound.  */
+static bool
+header_ok (struct index_header const *h, size_t size)
+{
+  return (memcmp (h->magic, warn_index_magic, sizeof h->magic) == 0
+          && h->version == WARN_INDEX_VERSION
+          && h->size == size
+          && h->n_dirs <= h->n_records
+          && h->n_records < h->n_slots
+          && (h->n_slots & (h->n_slots - 1)) == 0
+          && h->n_filter_blocks != 0
+          && (h->n_filter_blocks & (h->n_filter_blocks - 1)) == 0
+          && section_fits (h->records, h->n_records,
+                           sizeof (struct index_record), size)
+          && section_fits (h->slots, h->n_slots,
+                           sizeof (struct index_slot), size)
+          && section_fits (h->filter, h->n_filter_blocks,
+                           sizeof (struct dev_ino_filter_block), size)
+          && section_fits (h->keys, h->n_keys,
+                           sizeof (struct index_key), size)
+          && section_fits (h->globs, h->n_globs, sizeof (uint64_t), size)
+          && section_fits (h->strings, h->strings_size, 1, size)
+          && h->strings_size != 0
+          && ((char const *) h)[h->strings + h->strings_size - 1] == '\0');
+}
+
+/* Map the index FILE, and return it if it is trustworthy and was made
+   from the list with status *LIST_ST as it is now, and NULL
+   otherwise.  */
+struct warn_index *
+warn_index_map (char const *file, struct stat const *list_st)
+{
+  struct stat st;
+  int fd = open (file, O_RDONLY | O_NOFOLLOW | O_NOCTTY);
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &st) != 0
+      || ! S_ISREG (st.st_mode)
+      || ! (st.st_uid == 0 || st.st_uid == list_st->st_uid)
+      || (st.st_mode & (S_IWGRP | S_IWOTH))
+      || st.st_size < (off_t) sizeof (struct index_header)
+      || SIZE_MAX < st.st_size)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  void *base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  struct warn_index *index = xmalloc (sizeof *index);
+  index->base = base;
+  index->size = st.st_size;
+  index->mapped = true;
+  if (! header_ok (base, index->size))
+    {
+      warn_index_free (index);
+      return NULL;
+    }
+  set_sections (index);
+  if (! warn_index_is_for (index, list_st))
+    {
+      warn_index_free (index);
+      return NULL;
+    }
+  return index;
+}
+
+/* Write INDEX to FILE, replacing it at once with a whole new index.
+   Return true if that works.  */
+bool
+warn_index_publish (struct warn_index const *index, char const *file)
+{
+  char *tmp = xasprintf ("%s/rmfd-warn-XXXXXX", WARN_INDEX_DIR);
+  int fd = mkstemp (tmp);
+  bool ok = false;
+
+  if (0 <= fd)
+    {
+      ok = (fchmod (fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0
+            && full_write (fd, index->base, index->size) == index->size);
+      ok &= close (fd) == 0;
+      ok = ok && rename (tmp, file) == 0;
+      if (! ok)
+        unlink (tmp);
+    }
+  free (tmp);
+  return ok;
+}
+
+void
+warn_index_free (struct warn_index *index)
+{
+  if (! index)
+    return;
+  if (index->mapped)
+    munmap (index->base, index->size);
+  else
+    free (index->base);
+  free (index);
+}
+
+static char const *
+index_string (struct warn_index const *index, uint64_t offset)
+{
+  return (offset < index->header->strings_size
+          ? index->strings + offset : "");
+}
+
+/* Return false if there is certainly no record for the file with
+   device DEV and inode number INO.  */
+bool
+warn_index_may_contain (struct warn_index const *index, dev_t dev, ino_t ino)
+{
+  return dev_ino_filter_get (index->filter, index->header->n_filter_blocks,
+                             dev_ino_hash (dev, ino));
+}
+
+/* Look up the file with device DEV and inode number INO, and if it has
+   a record set *RECORD to its number and return true.  */
+bool
+warn_index_lookup (struct warn_index const *index, dev_t dev, ino_t ino,
+                   size_t *record)
+{
+  uint64_t h = dev_ino_hash (dev, ino);
+  size_t mask = index->header->n_slots - 1;
+  size_t i;
+  size_t n;
+
+  if (! dev_ino_filter_get (index->filter, index->header->n_filter_blocks, h))
+    return false;
+
+  for (i = h & mask, n = 0; index->slot[i].record && n <= mask;
+       i = (i + 1) & mask, n++)
+    if (index->slot[i].ino == (uint64_t) ino
+        && index->slot[i].dev == (uint64_t) dev)
+      {
+        if (index->header->n_records < index->slot[i].record)
+          return false;
+        *record = index->slot[i].record - 1;
+        return true;
+      }
+  return false;
+}
+
+size_t
+warn_index_n_records (struct warn_index const *index)
+{
+  return index->header->n_records;
+}
+
+/* Return the number of records of directories, which come first.  */
+size_t
+warn_index_n_dirs (struct warn_index const *index)
+{
+  return index->header->n_dirs;
+}
+
+void
+warn_index_record (struct warn_index const *index, size_t i,
+                   dev_t *dev, ino_t *ino, char const **given_path)
+{
+  *dev = index->record[i].dev;
+  *ino = index->record[i].ino;
+  *given_path = index_string (index, index->record[i].given_path);
+}
+
+size_t
+warn_index_n_keys (struct warn_index const *index)
+{
+  return index->header->n_keys;
+}
+
+/* Return the number of the first key not less than KEY.  */
+size_t
+warn_index_key_bound (struct warn_index const *index, char const *key)
+{
+  size_t lo = 0;
+  size_t hi = index->header->n_keys;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (strcmp (index_string (index, index->key[mid].key), key) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Return key I, and set *GIVEN_PATH to its line.  */
+char const *
+warn_index_key (struct warn_index const *index, size_t i,
+                char const **given_path)
+{
+  *given_path = index_string (index, index->key[i].given_path);
+  return index_string (index, index->key[i].key);
+}
+
+size_t
+warn_index_n_globs (struct warn_index const *index)
+{
+  return index->header->n_globs;
+}
+
+char const *
+warn_index_glob (struct warn_index const *index, size_t i)
+{
+  return index_string (index, index->glob[i]);
+}
+
+/* Return the invalid line of the list, or NULL if it had none.  */
+char const *
+warn_index_invalid_line (struct warn_index const *index)
+{
+  return (index->header->invalid_line
+          ? index_string (index, index->header->invalid_line) : NULL);
+}
@@ -0,0 +1,72 @@
+/* A prebuilt, read-only index of a warn.list, shared between processes.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef WARN_INDEX_H
+# define WARN_INDEX_H
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+
+struct warn_index;
+struct warn_index_builder;
+
+extern struct warn_index_builder *
+warn_index_builder_new (struct stat const *list_st);
+extern void warn_index_add_record (struct warn_index_builder *b,
+                                   struct stat const *st,
+                                   char const *given_path);
+extern void warn_index_add_key (struct warn_index_builder *b,
+                                char const *key, char const *given_path);
+extern void warn_index_add_glob (struct warn_index_builder *b,
+                                 char const *given_path);
+extern void warn_index_set_invalid_line (struct warn_index_builder *b,
+                                         char const *line);
+extern struct warn_index *warn_index_finish (struct warn_index_builder *b);
+
+extern char *warn_index_file_name (struct stat const *list_st);
+extern struct warn_index *warn_index_map (char const *file,
+                                          struct stat const *list_st);
+extern bool warn_index_publish (struct warn_index const *index,
+                                char const *file);
+extern void warn_index_free (struct warn_index *index);
+extern bool warn_index_is_for (struct warn_index const *index,
+                               struct stat const *list_st);
+
+extern bool warn_index_may_contain (struct warn_index const *index,
+                                    dev_t dev, ino_t ino);
+extern bool warn_index_lookup (struct warn_index const *index,
+                               dev_t dev, ino_t ino, size_t *record);
+extern size_t warn_index_n_records (struct warn_index const *index);
+extern size_t warn_index_n_dirs (struct warn_index const *index);
+extern void warn_index_record (struct warn_index const *index, size_t i,
+                               dev_t *dev, ino_t *ino,
+                               char const **given_path);
+
+extern size_t warn_index_n_keys (struct warn_index const *index);
+extern size_t warn_index_key_bound (struct warn_index const *index,
+                                    char const *key);
+extern char const *warn_index_key (struct warn_index const *index, size_t i,
+                                   char const **given_path);
+
+extern size_t warn_index_n_globs (struct warn_index const *index);
+extern char const *warn_index_glob (struct warn_index const *index,
+                                    size_t i);
+extern char const *warn_index_invalid_line (struct warn_index const *index);
+
+#endif
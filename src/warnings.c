@@ -0,0 +1,1404 @@
+/* warnings.c -- load ~/.rmfd/warn.list into a table of protected files
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "system.h"
+#include "concat-filename.h"
+#include "dev-ino-table.h"
+#include "hash.h"
+#include "stats.h"
+#include "warn-index.h"
+#include "warnings.h"
+#include "xstrndup.h"
+
+/* The system-wide warn.list, which applies to every user.  */
+#ifndef SYSTEM_WARN_LIST
+# define SYSTEM_WARN_LIST "/etc/rmfd/warn.list"
+#endif
+
+#if ! HAVE_STRUCT_DIRENT_D_TYPE
+# undef DT_UNKNOWN
+# undef DT_DIR
+# undef DT_LNK
+# define DT_UNKNOWN 0
+# define DT_DIR 1
+# define DT_LNK 2
+# define D_TYPE(d) DT_UNKNOWN
+#else
+# define D_TYPE(d) ((d)->d_type)
+#endif
+
+/* When looking for symbolic links among the listed entries of a
+   directory that is not under any operand, read the directory once
+   and use d_type if at least this many of its entries are listed.
+   Otherwise lstat each of them.  */
+enum { WARN_READDIR_MIN = 8 };
+
+/* warn.list is first loaded into a trie with one node for every
+   distinct leading sequence of file name components, so that "/a/b"
+   and "/a/c" share the node for "/a".  Only the nodes that may be
+   affected by the operands are statted and entered into the table of
+   device and inode numbers; the rest are deferred, and loaded only if
+   something later leads to them.
+
+   A line may also have glob patterns in its components, like "*" in
+   place of a directory name, or end in a "**" component to protect
+   everything under a directory.  A component with a pattern starts a
+   template: a subtrie kept apart from the ordinary children of its
+   parent, holding the rest of each such line.  When the trie is
+   walked to the parent, its directory is read once, and each entry
+   that matches the pattern gets a copy of the template, made only as
+   far as the files it names exist.  So the files that match are
+   statted and looked up by device and inode number like any other,
+   and patterns cost nothing once loaded.  */
+struct warn_node
+{
+  struct warn_node *parent;
+  /* The first child, and the next child of PARENT.  */
+  struct warn_node *child;
+  struct warn_node *sibling;
+  /* The line of warn.list naming this node, or NULL if the node is
+     only a prefix of such lines.  */
+  char *given_path;
+  /* True if the entries for GIVEN_PATH are in the table, or it is
+     known that they never need to be.  */
+  bool loaded;
+  /* True if LOADED holds for every node in this subtree.  */
+  bool subtree_loaded;
+  /* True if some loaded protected file is at or under PATH.  */
+  bool protected;
+  /* The protected file at PATH, if any.  */
+  struct warnings_entry *entry;
+  /* The children whose names are glob patterns.  They are templates,
+     as is everything under them.  */
+  struct warn_node **glob;
+  size_t n_globs;
+  size_t globs_alloc;
+  /* True if the entries of PATH are yet to be matched against GLOB.  */
+  bool globs_pending;
+  /* True if everything under PATH is protected.  */
+  bool everything_under;
+  /* True if this node is a template, not part of the trie proper.  */
+  bool template;
+  /* For a template, whether a line ends here, and if so whether it
+     ends in a slash, so that only a directory matches.  */
+  bool listed;
+  bool dir_only;
+  /* The last component of PATH, and its length.  */
+  char const *name;
+  size_t name_len;
+  /* The absolute file name of this node, without redundant slashes.  */
+  char path[1];
+};
+
+struct warnings_table
+{
+  /* warnings_entrys, keyed by their device and inode numbers.  */
+  struct dev_ino_table *entries;
+  /* warn_nodes, keyed by their parent and name.  */
+  Hash_table *nodes;
+  /* The node for "/".  */
+  struct warn_node *root;
+  /* The number of nodes with a GIVEN_PATH that are not LOADED or
+     with GLOBS_PENDING.  */
+  size_t n_deferred;
+  /* The canonical names of the operands.  */
+  char **root_name;
+  size_t n_roots;
+  /* The protected files under the operands, and how many of the
+     first ones the pre-scan is known to have found.  */
+  struct warnings_entry **reachable;
+  size_t n_reachable;
+  size_t n_seen;
+  /* The number of protected directories in the trie.  */
+  size_t n_dirs;
+  /* The index of the system-wide warn.list, or NULL, and the entries
+     for the files found in it, made as they are found.  The lines under
+     the operands are in the trie as well, as are those with patterns,
+     so only the protected files elsewhere are looked up in the index.  */
+  struct system_index *system;
+  struct warnings_entry **shared;
+  pthread_mutex_t shared_lock;
+  /* Where to count the system calls made for the table, or NULL.  */
+  struct stats *stats;
+};
+
+/* An index of the system-wide warn.list, and how many tables use it.  */
+struct system_index
+{
+  struct warn_index *index;
+  size_t refs;
+};
+
+static size_t
+warn_node_hash (void const *p, size_t n_buckets)
+{
+  struct warn_node const *node = p;
+  size_t h = (size_t) node->parent;
+  size_t i;
+  for (i = 0; i < node->name_len; i++)
+    h = h * 31 + (unsigned char) node->name[i];
+  return h % n_buckets;
+}
+
+static bool
+warn_node_comparator (void const *p1, void const *p2)
+{
+  struct warn_node const *n1 = p1, *n2 = p2;
+  return (n1->parent == n2->parent
+          && n1->name_len == n2->name_len
+          && memcmp (n1->name, n2->name, n1->name_len) == 0);
+}
+
+static struct warnings_entry *
+add_warnings_entry (struct warnings_table *table, struct stat const *st,
+                    char const *path)
+{
+  struct warnings_entry *entry =
+    dev_ino_table_lookup (table->entries, st->st_dev, st->st_ino);
+  if (entry)
+    return entry;
+
+  entry =
+    dev_ino_table_alloc (table->entries, sizeof *entry + strlen (path));
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->response = T_UNKNOWN;
+  entry->seen = false;
+  strcpy (entry->given_path, path);
+  dev_ino_table_insert (table->entries, entry->dev, entry->ino, entry);
+
+  if (S_ISDIR (st->st_mode))
+    table->n_dirs++;
+  return entry;
+}
+
+/* Return the canonical name of FILE, resolving its last component
+   only if RESOLVE_LAST, or NULL if that can't be determined.  */
+static char *
+canonical_name (char const *file, bool resolve_last)
+{
+  if (resolve_last)
+    return canonicalize_file_name (file);
+
+  char *base = last_component (file);
+  size_t base_length = base_len (base);
+  if (base_length == 0 || dot_or_dotdot (base))
+    return canonicalize_file_name (file);
+
+  char *dir = dir_name (file);
+  char *dir_resolved = canonicalize_file_name (dir);
+  free (dir);
+  if (! dir_resolved)
+    return NULL;
+
+  char *result = xmalloc (strlen (dir_resolved) + base_length + 2);
+  sprintf (result, "%s/%.*s", dir_resolved, (int) base_length, base);
+  free (dir_resolved);
+  return result;
+}
+
+/* Record that ENTRY is the protected file at NODE.  */
+static void
+mark_node (struct warn_node *node, struct warnings_entry *entry)
+{
+  struct warn_node *n;
+
+  if (! node->entry)
+    node->entry = entry;
+  for (n = node; n && ! n->protected; n = n->parent)
+    n->protected = true;
+}
+
+static struct warn_node *insert_node (struct warnings_table *table,
+                                      char const *file);
+static void expand_globs (struct warnings_table *table,
+                          struct warn_node *node);
+
+/* Record that ENTRY is the protected file at PATH, resolving its last
+   component only if RESOLVE_LAST.  */
+static void
+mark_name (struct warnings_table *table, char const *path, bool resolve_last,
+           struct warnings_entry *entry)
+{
+  char *name = canonical_name (path, resolve_last);
+  if (name)
+    {
+      mark_node (insert_node (table, name), entry);
+      free (name);
+    }
+}
+
+/* Add the entries for PATH, whose lstat information is *LST.  If PATH
+   is a symbolic link, both the link and its target are protected.
+   NODE is the node for PATH if PATH is known to be canonical, and NULL
+   otherwise.  */
+static void
+add_path_entries (struct warnings_table *table, char const *path,
+                  struct stat const *lst, struct warn_node *node)
+{
+  struct stat st;
+
+  struct warnings_entry *entry = add_warnings_entry (table, lst, path);
+  if (node)
+    mark_node (node, entry);
+  else
+    mark_name (table, path, false, entry);
+
+  if (S_ISLNK (lst->st_mode))
+    {
+      stats_count (table->stats, STATS_SITE_TABLE, STATS_STAT);
+      if (stat (path, &st) == 0)
+        mark_name (table, path, true, add_warnings_entry (table, &st, path));
+    }
+}
+
+static void
+load_path (struct warnings_table *table, char const *path,
+           struct warn_node *node)
+{
+  struct stat st;
+  stats_count (table->stats, STATS_SITE_TABLE, STATS_FSTATAT);
+  if (lstat (path, &st) == 0)
+    add_path_entries (table, path, &st, node);
+}
+
+/* Mark NODE loaded, using *LST for its entries if LST is non-NULL.
+   CANONICAL tells whether NODE's position in the trie is where the
+   file really is, i.e., no directory above it is a symlink.  */
+static void
+load_node (struct warnings_table *table, struct warn_node *node,
+           struct stat const *lst, bool canonical)
+{
+  if (node->loaded)
+    return;
+  node->loaded = true;
+  if (node->given_path)
+    {
+      struct warn_node *at = canonical ? node : NULL;
+      table->n_deferred--;
+      if (lst)
+        add_path_entries (table, node->given_path, lst, at);
+      else
+        load_path (table, node->given_path, at);
+    }
+}
+
+static void
+load_subtree (struct warnings_table *table, struct warn_node *node,
+              bool canonical)
+{
+  struct warn_node *c;
+
+  if (node->subtree_loaded)
+    return;
+  load_node (table, node, NULL, canonical);
+  expand_globs (table, node);
+  for (c = node->child; c; c = c->sibling)
+    load_subtree (table, c, canonical);
+  node->subtree_loaded = true;
+}
+
+/* Mark every node in the subtree at NODE loaded without adding any
+   entries, because the file NODE names does not exist.  */
+static void
+discard_subtree (struct warnings_table *table, struct warn_node *node)
+{
+  struct warn_node *c;
+
+  if (node->subtree_loaded)
+    return;
+  if (! node->loaded && node->given_path)
+    table->n_deferred--;
+  node->loaded = true;
+  if (node->globs_pending)
+    {
+      node->globs_pending = false;
+      table->n_deferred--;
+    }
+  for (c = node->child; c; c = c->sibling)
+    discard_subtree (table, c);
+  node->subtree_loaded = true;
+}
+
+static struct warn_node *
+find_child (struct warnings_table const *table, struct warn_node *parent,
+            char const *name, size_t name_len)
+{
+  struct warn_node key;
+  key.parent = parent;
+  key.name = name;
+  key.name_len = name_len;
+  return hash_lookup (table->nodes, &key);
+}
+
+static struct warn_node *
+new_node (struct warn_node *parent, char const *name, size_t name_len)
+{
+  size_t parent_len = parent ? strlen (parent->path) : 0;
+  /* The children of "/" don't need another slash.  */
+  if (parent_len == 1)
+    parent_len = 0;
+
+  struct warn_node *node = xmalloc (sizeof *node + parent_len + name_len + 1);
+  node->parent = parent;
+  node->child = NULL;
+  node->sibling = NULL;
+  node->given_path = NULL;
+  node->loaded = true;
+  node->subtree_loaded = false;
+  node->protected = false;
+  node->entry = NULL;
+  node->glob = NULL;
+  node->n_globs = node->globs_alloc = 0;
+  node->globs_pending = false;
+  node->everything_under = false;
+  node->template = false;
+  node->listed = false;
+  node->dir_only = false;
+  if (parent)
+    {
+      memcpy (node->path, parent->path, parent_len);
+      node->path[parent_len] = '/';
+      memcpy (node->path + parent_len + 1, name, name_len);
+      node->path[parent_len + 1 + name_len] = '\0';
+      node->name = node->path + parent_len + 1;
+      node->name_len = name_len;
+      node->sibling = parent->child;
+      parent->child = node;
+    }
+  else
+    {
+      strcpy (node->path, "/");
+      node->name = node->path + 1;
+      node->name_len = 0;
+    }
+  return node;
+}
+
+/* Iterate over the components of the absolute file name File, setting
+   Name to the start of each and Len to its length.  */
+#define FOR_EACH_COMPONENT(File, Name, Len)			\
+  for (Name = File; *(Name += strspn (Name, "/"))		\
+         && ((Len = strcspn (Name, "/")), true);		\
+       Name += Len)
+
+/* Return the node for the absolute file name FILE, or NULL if there is
+   none.  If PARENT_P is not NULL, set *PARENT_P to the deepest node
+   found on the way, or to NULL if the node for FILE's parent was not
+   found either.  */
+static struct warn_node *
+find_path (struct warnings_table *table, char const *file,
+           struct warn_node **parent_p)
+{
+  struct warn_node *node = table->root;
+  struct warn_node *parent = NULL;
+  char const *name;
+  size_t len;
+
+  FOR_EACH_COMPONENT (file, name, len)
+    {
+      parent = node;
+      node = find_child (table, node, name, len);
+      if (! node)
+        {
+          /* Only report FILE's parent, not some other ancestor.  */
+          if (name[len + strspn (name + len, "/")])
+            parent = NULL;
+          break;
+        }
+    }
+
+  if (parent_p)
+    *parent_p = parent;
+  return node;
+}
+
+/* Mark NODE as listed in warn.list as GIVEN_PATH, and deferred.  */
+static void
+list_node (struct warnings_table *table, struct warn_node *node,
+           char *given_path)
+{
+  struct warn_node *n;
+
+  node->given_path = given_path;
+  node->loaded = false;
+  table->n_deferred++;
+  /* Nodes added by insert_node start out loaded.  */
+  for (n = node; n && n->subtree_loaded; n = n->parent)
+    n->subtree_loaded = false;
+}
+
+/* Return true if the file name component NAME, of length LEN, is a
+   glob pattern.  */
+static bool
+is_glob (char const *name, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+    if (name[i] == '*' || name[i] == '?' || name[i] == '[')
+      return true;
+  return false;
+}
+
+/* Add the template G to the glob children of NODE, unless it is there
+   already.  */
+static void
+add_glob (struct warnings_table *table, struct warn_node *node,
+          struct warn_node *g)
+{
+  size_t i;
+
+  for (i = 0; i < node->n_globs; i++)
+    if (node->glob[i] == g)
+      return;
+  if (node->n_globs == node->globs_alloc)
+    node->glob = x2nrealloc (node->glob, &node->globs_alloc,
+                             sizeof *node->glob);
+  node->glob[node->n_globs++] = g;
+
+  if (! node->template && ! node->globs_pending)
+    {
+      struct warn_node *n;
+      node->globs_pending = true;
+      table->n_deferred++;
+      for (n = node; n && n->subtree_loaded; n = n->parent)
+        n->subtree_loaded = false;
+    }
+}
+
+/* Return the glob child of NODE with the pattern NAME, of length LEN,
+   creating it if need be.  */
+static struct warn_node *
+glob_child (struct warnings_table *table, struct warn_node *node,
+            char const *name, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < node->n_globs; i++)
+    if (node->glob[i]->name_len == len
+        && memcmp (node->glob[i]->name, name, len) == 0)
+      return node->glob[i];
+
+  /* new_node made G the first ordinary child.  */
+  struct warn_node *g = new_node (node, name, len);
+  node->child = g->sibling;
+  g->sibling = NULL;
+  g->template = true;
+  add_glob (table, node, g);
+  return g;
+}
+
+/* Insert the line PATH from warn.list into the trie.  Return false
+   without inserting anything if PATH has a "." or ".." component,
+   since its position in the trie would say nothing about where it
+   is.  */
+static bool
+insert_path (struct warnings_table *table, char const *path)
+{
+  struct warn_node *node = table->root;
+  char const *name;
+  size_t len;
+  char const *end = NULL;
+
+  FOR_EACH_COMPONENT (path, name, len)
+    if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+      return false;
+
+  FOR_EACH_COMPONENT (path, name, len)
+    {
+      if (len == 2 && name[0] == '*' && name[1] == '*'
+          && ! name[len + strspn (name + len, "/")])
+        {
+          /* A final "**" protects NODE and everything under it.  */
+          node->everything_under = true;
+          for (end = name; path + 1 < end && ISSLASH (end[-1]); end--)
+            continue;
+          break;
+        }
+
+      struct warn_node *child;
+      if (is_glob (name, len))
+        child = glob_child (table, node, name, len);
+      else
+        {
+          child = find_child (table, node, name, len);
+          if (! child)
+            {
+              child = new_node (node, name, len);
+              child->template = node->template;
+              if (! hash_insert (table->nodes, child))
+                xalloc_die ();
+            }
+        }
+      node = child;
+    }
+
+  if (node->template)
+    {
+      node->listed = true;
+      if (! end && ISSLASH (path[strlen (path) - 1]))
+        node->dir_only = true;
+    }
+  else if (! node->given_path)
+    list_node (table, node,
+               end ? xstrndup (path, end - path) : xstrdup (path));
+  return true;
+}
+
+/* Return the node for the canonical name FILE, creating it and any
+   missing ancestors.  New nodes are not listed and need no loading.  */
+static struct warn_node *
+insert_node (struct warnings_table *table, char const *file)
+{
+  struct warn_node *node = table->root;
+  char const *name;
+  size_t len;
+
+  FOR_EACH_COMPONENT (file, name, len)
+    {
+      struct warn_node *child = find_child (table, node, name, len);
+      if (! child)
+        {
+          child = new_node (node, name, len);
+          child->subtree_loaded = true;
+          if (! hash_insert (table->nodes, child))
+            xalloc_die ();
+        }
+      node = child;
+    }
+  return node;
+}
+
+/* Return the child NAME, of length LEN, of NODE, which is not a
+   template, creating it if need be.  */
+static struct warn_node *
+real_child (struct warnings_table *table, struct warn_node *node,
+            char const *name, size_t len)
+{
+  struct warn_node *child = find_child (table, node, name, len);
+  if (! child)
+    {
+      child = new_node (node, name, len);
+      child->subtree_loaded = true;
+      if (! hash_insert (table->nodes, child))
+        xalloc_die ();
+    }
+  return child;
+}
+
+/* Copy into the subtree at NODE what the template TMPL says is listed
+   there.  If TMPL has many children, read the directory NODE and copy
+   only those that exist.  */
+static void
+instantiate (struct warnings_table *table, struct warn_node *node,
+             struct warn_node *tmpl)
+{
+  struct warn_node *c;
+  size_t n_children = 0;
+  size_t i;
+  DIR *dirp = NULL;
+  bool read_all = false;
+
+  if (tmpl->listed && ! node->given_path)
+    list_node (table, node, (tmpl->dir_only
+                             ? xconcatenated_filename (node->path, "", NULL)
+                             : xstrdup (node->path)));
+  if (tmpl->everything_under)
+    node->everything_under = true;
+  for (i = 0; i < tmpl->n_globs; i++)
+    add_glob (table, node, tmpl->glob[i]);
+
+  for (c = tmpl->child; c; c = c->sibling)
+    n_children++;
+  if (WARN_READDIR_MIN <= n_children)
+    {
+      stats_count (table->stats, STATS_SITE_TABLE, STATS_READDIR);
+      dirp = opendir (node->path);
+    }
+
+  if (dirp)
+    {
+      struct dirent const *dp;
+
+      while (1)
+        {
+          /* readdir sets errno on failure but not on success.  */
+          errno = 0;
+          dp = readdir_ignoring_dot_and_dotdot (dirp);
+          if (! dp)
+            break;
+          c = find_child (table, tmpl, dp->d_name, _D_EXACT_NAMLEN (dp));
+          if (c)
+            instantiate (table, real_child (table, node, c->name,
+                                            c->name_len), c);
+        }
+      read_all = errno == 0;
+      closedir (dirp);
+    }
+
+  /* Without the whole directory, copy every child of the template,
+     those already copied again, which changes nothing.  */
+  if (! read_all)
+    for (c = tmpl->child; c; c = c->sibling)
+      instantiate (table, real_child (table, node, c->name, c->name_len), c);
+}
+
+/* Match the entries of the directory NODE against the glob children
+   of NODE, and copy each matching template under the entry.  */
+static void
+expand_globs (struct warnings_table *table, struct warn_node *node)
+{
+  if (! node->globs_pending)
+    return;
+  node->globs_pending = false;
+  table->n_deferred--;
+
+  stats_count (table->stats, STATS_SITE_TABLE, STATS_READDIR);
+  DIR *dirp = opendir (node->path);
+  if (! dirp)
+    return;
+
+  struct dirent const *dp;
+  while ((dp = readdir_ignoring_dot_and_dotdot (dirp)))
+    {
+      size_t i;
+      for (i = 0; i < node->n_globs; i++)
+        if (fnmatch (node->glob[i]->name, dp->d_name, FNM_PERIOD) == 0)
+          instantiate (table, real_child (table, node, dp->d_name,
+                                          _D_EXACT_NAMLEN (dp)),
+                       node->glob[i]);
+    }
+  closedir (dirp);
+}
+
+/* Load the entries affected by removing the file whose canonical name
+   is FILE: everything listed under it, and its parent directory, which
+   check_globs looks at.  */
+static void
+load_operand (struct warnings_table *table, char const *file)
+{
+  struct warn_node *parent;
+  struct warn_node *node = table->root;
+  bool inside = false;
+  char const *name;
+  size_t len;
+
+  /* Match the patterns on the way to FILE first, and protect FILE if
+     it is under a directory listed with "/**".  */
+  FOR_EACH_COMPONENT (file, name, len)
+    {
+      expand_globs (table, node);
+      inside |= node->everything_under;
+      node = find_child (table, node, name, len);
+      if (! node)
+        break;
+    }
+  if (inside)
+    load_path (table, file, NULL);
+
+  node = find_path (table, file, &parent);
+
+  if (parent)
+    load_node (table, parent, NULL, true);
+  if (node)
+    load_subtree (table, node, true);
+}
+
+static void scan_deferred (struct warnings_table *table,
+                           struct warn_node *dir);
+
+/* Find out what type of file NODE is with lstat, and load or scan it
+   accordingly.  */
+static void
+scan_node (struct warnings_table *table, struct warn_node *node)
+{
+  struct stat st;
+
+  if (node->subtree_loaded)
+    return;
+
+  stats_count (table->stats, STATS_SITE_TABLE, STATS_FSTATAT);
+  if (lstat (node->path, &st) != 0)
+    discard_subtree (table, node);
+  else if (S_ISLNK (st.st_mode))
+    {
+      /* Everything listed at or below a symlink may really be
+         anywhere, including under one of the operands.  */
+      load_node (table, node, &st, true);
+      load_subtree (table, node, false);
+    }
+  else
+    {
+      /* There's no point in deferring a file we have already
+         statted.  */
+      load_node (table, node, &st, true);
+      if (S_ISDIR (st.st_mode))
+        scan_deferred (table, node);
+      else
+        discard_subtree (table, node);
+    }
+}
+
+/* Walk the part of the trie under the real directory DIR that is not
+   loaded, loading every symbolic link and everything listed under a
+   symbolic link, since they may lead into an operand.  Load listed
+   directories too, so that the pre-scan knows where a symbolic link
+   may lead.  Other entries stay deferred.  If DIR has many listed
+   children, find their types with d_type, to avoid an lstat for
+   each.  */
+static void
+scan_deferred (struct warnings_table *table, struct warn_node *dir)
+{
+  struct warn_node *c;
+  size_t n_children = 0;
+  DIR *dirp = NULL;
+
+  expand_globs (table, dir);
+  for (c = dir->child; c; c = c->sibling)
+    if (! c->subtree_loaded)
+      n_children++;
+  if (n_children == 0)
+    return;
+
+  if (WARN_READDIR_MIN <= n_children)
+    {
+      stats_count (table->stats, STATS_SITE_TABLE, STATS_READDIR);
+      dirp = opendir (dir->path);
+    }
+
+  if (dirp)
+    {
+      struct dirent const *dp;
+
+      while (1)
+        {
+          /* readdir sets errno on failure but not on success.  */
+          errno = 0;
+          dp = readdir_ignoring_dot_and_dotdot (dirp);
+          if (! dp)
+            break;
+          c = find_child (table, dir, dp->d_name, _D_EXACT_NAMLEN (dp));
+          if (! c || c->subtree_loaded)
+            continue;
+          switch (D_TYPE (dp))
+            {
+            case DT_DIR:
+              /* Load listed directories, so that the pre-scan knows
+                 which ones a symbolic link might lead to.  */
+              load_node (table, c, NULL, true);
+              scan_deferred (table, c);
+              break;
+
+            case DT_LNK:
+            case DT_UNKNOWN:
+              scan_node (table, c);
+              break;
+
+            default:
+              /* A listed non-directory that is not a symlink can be
+                 reached only through its own name, so it can stay
+                 deferred.  */
+              break;
+            }
+        }
+      if (errno)
+        {
+          /* Fall back to lstat for whatever we missed.  */
+          for (c = dir->child; c; c = c->sibling)
+            scan_node (table, c);
+        }
+      closedir (dirp);
+    }
+  else
+    for (c = dir->child; c; c = c->sibling)
+      scan_node (table, c);
+}
+
+/* Append the protected files at or under NODE to TABLE->reachable,
+   which has room for *N_ALLOC of them.  */
+static void
+add_reachable (struct warnings_table *table, struct warn_node *node,
+               size_t *n_alloc)
+{
+  struct warn_node *c;
+
+  if (! node->protected)
+    return;
+  if (node->entry)
+    {
+      if (table->n_reachable == *n_alloc)
+        table->reachable = x2nrealloc (table->reachable, n_alloc,
+                                       sizeof *table->reachable);
+      table->reachable[table->n_reachable++] = node->entry;
+    }
+  for (c = node->child; c; c = c->sibling)
+    add_reachable (table, c, n_alloc);
+}
+
+/* Free NODE and everything under it, with the templates it owns.  */
+static void
+free_node (struct warn_node *node)
+{
+  struct warn_node *c = node->child;
+  size_t i;
+
+  while (c)
+    {
+      struct warn_node *sibling = c->sibling;
+      free_node (c);
+      c = sibling;
+    }
+  /* instantiate shares the templates of TMPL with each copy.  */
+  for (i = 0; i < node->n_globs; i++)
+    if (node->glob[i]->parent == node)
+      free_node (node->glob[i]);
+  free (node->glob);
+  free (node->given_path);
+  free (node);
+}
+
+/* Return the name of the warn.list of the user, ~/.rmfd/warn.list, or
+   NULL if HOME is not set.  */
+char *
+warn_list_file_name (void)
+{
+  char const *home_dir = getenv ("HOME");
+  if (! home_dir)
+    return NULL;
+  return xconcatenated_filename (home_dir, ".rmfd/warn.list", NULL);
+}
+
+/* Read the lines of the warn.list FILE, stopping at the first that is
+   not an absolute file name, and if ST is not NULL set *ST to the
+   status of FILE.  If we can't read that file return NULL.  */
+static struct warn_list *
+warn_list_read_file (char const *file, struct stat *st)
+{
+  FILE *fp = fopen (file, "r");
+  if (! fp)
+    return NULL;
+  if (st && fstat (fileno (fp), st) != 0)
+    {
+      fclose (fp);
+      return NULL;
+    }
+
+  struct warn_list *list = xmalloc (sizeof *list);
+  size_t lines_alloc = 0;
+  list->line = NULL;
+  list->n_lines = 0;
+  list->invalid_line = NULL;
+
+  char *line = NULL;
+  size_t length;
+  ssize_t read;
+  while (-1 != (read = getline (&line, &length, fp)))
+    {
+      if (line[read - 1] == '\n')
+        line[--read] = '\0';
+      if (line[0] != '/')
+        {
+          list->invalid_line = line;
+          line = NULL;
+          break;
+        }
+      if (list->n_lines == lines_alloc)
+        list->line = x2nrealloc (list->line, &lines_alloc,
+                                 sizeof *list->line);
+      list->line[list->n_lines++] = xstrndup (line, read);
+    }
+
+  free (line);
+  fclose (fp);
+  return list;
+}
+
+/* Read the lines of the warn.list of the user as warn_list_read_file
+   does.  */
+struct warn_list *
+warn_list_read (void)
+{
+  char *path = warn_list_file_name ();
+  if (! path)
+    return NULL;
+  struct warn_list *list = warn_list_read_file (path, NULL);
+  free (path);
+  return list;
+}
+
+void
+warn_list_free (struct warn_list *list)
+{
+  size_t i;
+
+  if (! list)
+    return;
+  for (i = 0; i < list->n_lines; i++)
+    free (list->line[i]);
+  free (list->line);
+  free (list->invalid_line);
+  free (list);
+}
+
+/* Return the name of the system-wide warn.list, which
+   RMFD_SYSTEM_WARN_LIST in the environment overrides.  */
+char const *
+system_warn_list_name (void)
+{
+  char const *name = getenv ("RMFD_SYSTEM_WARN_LIST");
+  return name && *name ? name : SYSTEM_WARN_LIST;
+}
+
+/* Return true if the line PATH has a glob pattern in it.  */
+static bool
+has_glob (char const *path)
+{
+  char const *name;
+  size_t len;
+
+  FOR_EACH_COMPONENT (path, name, len)
+    if (is_glob (name, len))
+      return true;
+  return false;
+}
+
+/* Return an index of LIST, the lines of a warn.list with status *ST:
+   the files each line names, as load_path would find them, and the
+   canonical names the trie would put them under.  */
+static struct warn_index *
+build_index (struct warn_list const *list, struct stat const *st)
+{
+  struct warn_index_builder *b = warn_index_builder_new (st);
+  size_t i;
+
+  for (i = 0; i < list->n_lines; i++)
+    {
+      char const *line = list->line[i];
+      struct stat lst;
+      struct stat target;
+      int resolve_last;
+
+      if (has_glob (line))
+        {
+          warn_index_add_glob (b, line);
+          continue;
+        }
+
+      bool exists = lstat (line, &lst) == 0;
+      bool is_link = exists && S_ISLNK (lst.st_mode);
+      if (exists)
+        warn_index_add_record (b, &lst, line);
+      if (is_link && stat (line, &target) == 0)
+        warn_index_add_record (b, &target, line);
+
+      /* A symbolic link is protected both where it is and where it
+         leads.  */
+      for (resolve_last = 0; resolve_last <= is_link; resolve_last++)
+        {
+          char *key = canonical_name (line, resolve_last);
+          warn_index_add_key (b, key ? key : line, line);
+          free (key);
+        }
+    }
+  if (list->invalid_line)
+    warn_index_set_invalid_line (b, list->invalid_line);
+
+  return warn_index_finish (b);
+}
+
+/* Return the index of the system-wide warn.list FILE, whose status is
+   *ST: the one in shared memory if it is up to date, or else a new one,
+   which is published for the other processes if this one may.  */
+static struct warn_index *
+load_system_index (char const *file, struct stat const *st)
+{
+  char *index_file = warn_index_file_name (st);
+  struct warn_index *index = warn_index_map (index_file, st);
+
+  if (! index)
+    {
+      struct stat list_st;
+      struct warn_list *list = warn_list_read_file (file, &list_st);
+      if (list)
+        {
+          index = build_index (list, &list_st);
+          warn_list_free (list);
+          uid_t euid = geteuid ();
+          if (euid == 0 || euid == list_st.st_uid)
+            warn_index_publish (index, index_file);
+        }
+    }
+
+  free (index_file);
+  return index;
+}
+
+/* The index of the system-wide warn.list as it was last loaded, and
+   the lock that protects it and the reference counts.  */
+static struct system_index *current_system_index;
+static pthread_mutex_t system_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+unref_system_index (struct system_index *s)
+{
+  if (--s->refs == 0 && s != current_system_index)
+    {
+      warn_index_free (s->index);
+      free (s);
+    }
+}
+
+/* Return a reference to the index of the system-wide warn.list as it is
+   now, or NULL if there is none, which system_index_release must drop.
+   The index is loaded again only if the list has changed since.  */
+struct system_index *
+system_index_acquire (void)
+{
+  char const *file = system_warn_list_name ();
+  struct system_index *s = NULL;
+  struct stat st;
+
+  pthread_mutex_lock (&system_index_lock);
+  bool exists = stat (file, &st) == 0;
+  if (! exists
+      || ! current_system_index
+      || ! warn_index_is_for (current_system_index->index, &st))
+    {
+      struct system_index *old = current_system_index;
+      current_system_index = NULL;
+      if (old && old->refs == 0)
+        {
+          warn_index_free (old->index);
+          free (old);
+        }
+
+      struct warn_index *index = exists ? load_system_index (file, &st) : NULL;
+      if (index)
+        {
+          current_system_index = xmalloc (sizeof *current_system_index);
+          current_system_index->index = index;
+          current_system_index->refs = 0;
+        }
+    }
+  s = current_system_index;
+  if (s)
+    s->refs++;
+  pthread_mutex_unlock (&system_index_lock);
+  return s;
+}
+
+void
+system_index_release (struct system_index *s)
+{
+  if (! s)
+    return;
+  pthread_mutex_lock (&system_index_lock);
+  unref_system_index (s);
+  pthread_mutex_unlock (&system_index_lock);
+}
+
+/* Return the first line of the system-wide warn.list that is not an
+   absolute file name, or NULL.  */
+char const *
+system_index_invalid_line (struct system_index const *s)
+{
+  return warn_index_invalid_line (s->index);
+}
+
+/* Return the entry for record I of the system index of TABLE.  */
+static struct warnings_entry *
+shared_entry (struct warnings_table *table, size_t i)
+{
+  struct warnings_entry *entry;
+
+  pthread_mutex_lock (&table->shared_lock);
+  entry = table->shared[i];
+  if (! entry)
+    {
+      dev_t dev;
+      ino_t ino;
+      char const *given_path;
+      warn_index_record (table->system->index, i, &dev, &ino, &given_path);
+      entry = xmalloc (sizeof *entry + strlen (given_path));
+      entry->dev = dev;
+      entry->ino = ino;
+      entry->response = T_UNKNOWN;
+      entry->seen = false;
+      strcpy (entry->given_path, given_path);
+      table->shared[i] = entry;
+    }
+  pthread_mutex_unlock (&table->shared_lock);
+  return entry;
+}
+
+/* Insert into TABLE the line GIVEN_PATH of the system index, as
+   create_warnings_table inserts the lines of the user's.  */
+static void
+insert_line (struct warnings_table *table, char const *given_path)
+{
+  if (! insert_path (table, given_path))
+    load_path (table, given_path, NULL);
+}
+
+/* Insert into TABLE the lines of its system index that name the file
+   whose canonical name is FILE, the files under it, or its parent,
+   which are what load_operand loads.  */
+static void
+insert_index_lines (struct warnings_table *table, char const *file)
+{
+  struct warn_index const *index = table->system->index;
+  size_t n_keys = warn_index_n_keys (index);
+  char const *given_path;
+  size_t i;
+
+  for (i = warn_index_key_bound (index, file);
+       i < n_keys && STREQ (warn_index_key (index, i, &given_path), file);
+       i++)
+    insert_line (table, given_path);
+
+  if (STREQ (file, "/"))
+    {
+      for (i = 0; i < n_keys; i++)
+        {
+          warn_index_key (index, i, &given_path);
+          insert_line (table, given_path);
+        }
+      return;
+    }
+
+  char *prefix = xconcatenated_filename (file, "", NULL);
+  size_t prefix_len = strlen (prefix);
+  for (i = warn_index_key_bound (index, prefix);
+       (i < n_keys
+        && strncmp (warn_index_key (index, i, &given_path), prefix,
+                    prefix_len) == 0);
+       i++)
+    insert_line (table, given_path);
+  free (prefix);
+
+  char *dir = dir_name (file);
+  for (i = warn_index_key_bound (index, dir);
+       i < n_keys && STREQ (warn_index_key (index, i, &given_path), dir);
+       i++)
+    insert_line (table, given_path);
+  free (dir);
+}
+
+/* Create the table of device and inode number pairs to warn about,
+   from the lines of warn.list in LIST, if not NULL, and the system
+   index SYSTEM, if not NULL, neither of which may have an invalid line.
+   The table takes over the reference to SYSTEM.  Only entries that may
+   be affected by removing the FILEs are statted right away.  The
+   system calls made for the table are counted in STATS, if not NULL.  */
+struct warnings_table *
+create_warnings_table (char *const *file, struct warn_list const *list,
+                       struct system_index *system, struct stats *stats)
+{
+  size_t i;
+
+  struct warnings_table *table = xmalloc (sizeof *table);
+  table->entries = dev_ino_table_create ();
+  table->nodes = hash_initialize (41, NULL, warn_node_hash,
+                                  warn_node_comparator, NULL);
+  if (! table->nodes)
+    xalloc_die ();
+  table->root = new_node (NULL, "", 0);
+  table->n_deferred = 0;
+  table->n_reachable = table->n_seen = 0;
+  table->n_dirs = 0;
+  table->system = system;
+  table->shared = (system
+                   ? xcalloc (warn_index_n_records (system->index),
+                              sizeof *table->shared)
+                   : NULL);
+  pthread_mutex_init (&table->shared_lock, NULL);
+  table->stats = stats;
+
+  if (list)
+    for (i = 0; i < list->n_lines; i++)
+      if (! insert_path (table, list->line[i]))
+        load_path (table, list->line[i], NULL);
+  if (system)
+    for (i = 0; i < warn_index_n_globs (system->index); i++)
+      insert_line (table, warn_index_glob (system->index, i));
+
+  /* An operand is removed by its own name, so look it up with its
+     last component unresolved, but its contents are also those of
+     whatever it resolves to.  */
+  size_t n_files = 0;
+  while (file[n_files])
+    n_files++;
+  table->root_name = xnmalloc (2 * n_files, sizeof *table->root_name);
+  table->n_roots = 0;
+  for ( ; *file; ++file)
+    {
+      int i;
+      for (i = 0; i < 2; i++)
+        {
+          char *name = canonical_name (*file, i == 0);
+          if (name)
+            table->root_name[table->n_roots++] = name;
+        }
+    }
+  if (system)
+    for (i = 0; i < table->n_roots; i++)
+      insert_index_lines (table, table->root_name[i]);
+  for (i = 0; i < table->n_roots; i++)
+    load_operand (table, table->root_name[i]);
+
+  if (table->n_deferred)
+    scan_deferred (table, table->root);
+
+  /* Now that every symlink that might lead under an operand is
+     loaded, gather the protected files there.  */
+  size_t reachable_alloc = 0;
+  table->reachable = NULL;
+  for (i = 0; i < table->n_roots; i++)
+    {
+      struct warn_node *node = find_path (table, table->root_name[i], NULL);
+      if (node)
+        add_reachable (table, node, &reachable_alloc);
+    }
+
+  return table;
+}
+
+void
+warnings_table_free (struct warnings_table *table)
+{
+  size_t i;
+
+  if (! table)
+    return;
+  free_node (table->root);
+  hash_free (table->nodes);
+  dev_ino_table_free (table->entries);
+  for (i = 0; i < table->n_roots; i++)
+    free (table->root_name[i]);
+  free (table->root_name);
+  free (table->reachable);
+  if (table->system)
+    {
+      size_t n = warn_index_n_records (table->system->index);
+      for (i = 0; i < n; i++)
+        free (table->shared[i]);
+      free (table->shared);
+      system_index_release (table->system);
+    }
+  pthread_mutex_destroy (&table->shared_lock);
+  free (table);
+}
+
+/* Return the entry for the file with status *ST, or NULL if there is
+   none.  */
+struct warnings_entry *
+warnings_table_lookup (struct warnings_table *table, struct stat const *st)
+{
+  struct warnings_entry *found =
+    dev_ino_table_lookup (table->entries, st->st_dev, st->st_ino);
+  size_t record;
+
+  if (! found && table->system
+      && warn_index_lookup (table->system->index, st->st_dev, st->st_ino,
+                            &record))
+    found = shared_entry (table, record);
+  return found;
+}
+
+/* Return false if there is certainly no entry for the file with device
+   DEV and inode number INO.  This is cheaper than a lookup.  */
+bool
+warnings_table_may_contain (struct warnings_table const *table,
+                            dev_t dev, ino_t ino)
+{
+  return (dev_ino_table_may_contain (table->entries, dev, ino)
+          || (table->system
+              && warn_index_may_contain (table->system->index, dev, ino)));
+}
+
+/* Like warnings_table_lookup, but PATH is a symbolic link to the
+   directory with status *ST, which may be anywhere.  If it is listed
+   but deferred, load it now.  */
+struct warnings_entry *
+warnings_table_lookup_dir (struct warnings_table *table, char const *path,
+                           struct stat const *st)
+{
+  struct warnings_entry *found = warnings_table_lookup (table, st);
+  if (found || table->n_deferred == 0)
+    return found;
+
+  char *resolved = canonicalize_file_name (path);
+  if (! resolved)
+    return NULL;
+  struct warn_node *node = find_path (table, resolved, NULL);
+  free (resolved);
+  if (! node || node->loaded)
+    return NULL;
+
+  load_node (table, node, NULL, true);
+  return warnings_table_lookup (table, st);
+}
+
+/* Return the node for the directory DIR if any protected file is at
+   or under it, and NULL otherwise.  */
+struct warn_node *
+warnings_table_node (struct warnings_table *table, char const *dir)
+{
+  char *resolved = canonicalize_file_name (dir);
+  if (! resolved)
+    return NULL;
+  struct warn_node *node = find_path (table, resolved, NULL);
+  free (resolved);
+  return node && node->protected ? node : NULL;
+}
+
+/* Like warnings_table_node, for the entry NAME of the directory DIR.  */
+struct warn_node *
+warnings_node_child (struct warnings_table *table, struct warn_node *dir,
+                     char const *name)
+{
+  if (! dir)
+    return NULL;
+  struct warn_node *node = find_child (table, dir, name, strlen (name));
+  return node && node->protected ? node : NULL;
+}
+
+/* Return true if any protected directory is in TABLE.  */
+bool
+warnings_table_has_dirs (struct warnings_table const *table)
+{
+  return (table->n_dirs != 0
+          || (table->system && warn_index_n_dirs (table->system->index)));
+}
+
+/* Return true if the pre-scan has found every protected file under
+   the operands.  */
+bool
+warnings_table_all_seen (struct warnings_table *table)
+{
+  while (table->n_seen < table->n_reachable
+         && table->reachable[table->n_seen]->seen)
+    table->n_seen++;
+  return table->n_seen == table->n_reachable;
+}
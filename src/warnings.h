@@ -0,0 +1,86 @@
+/* The table of files that rm warns about before removing.
+
+   Copyright (C) 2010 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef WARNINGS_H
+# define WARNINGS_H
+
+# include <stdbool.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+
+enum Ternary
+{
+  T_UNKNOWN = 2,
+  T_NO,
+  T_YES
+};
+
+struct warnings_entry
+{
+  dev_t dev;
+  ino_t ino;
+  /* Cache the response of the user so we don't prompt for the same file
+     twice.  */
+  enum Ternary response;
+  /* True once the pre-scan has found this file under an operand.  */
+  bool seen;
+  /* The path given by the user in warn.list, used for prompting.  */
+  char given_path[1];
+};
+
+struct warnings_table;
+struct warn_node;
+struct system_index;
+struct stats;
+
+/* The lines of a warn.list.  */
+struct warn_list
+{
+  char **line;
+  size_t n_lines;
+  /* The first line that is not an absolute file name, or NULL.  LINE
+     holds only the lines before it.  */
+  char *invalid_line;
+};
+
+extern char *warn_list_file_name (void);
+extern struct warn_list *warn_list_read (void);
+extern void warn_list_free (struct warn_list *list);
+extern char const *system_warn_list_name (void);
+extern struct system_index *system_index_acquire (void);
+extern void system_index_release (struct system_index *s);
+extern char const *system_index_invalid_line (struct system_index const *s);
+extern struct warnings_table *
+create_warnings_table (char *const *file, struct warn_list const *list,
+                       struct system_index *system, struct stats *stats);
+extern void warnings_table_free (struct warnings_table *table);
+extern struct warnings_entry *
+warnings_table_lookup (struct warnings_table *table, struct stat const *st);
+extern bool warnings_table_may_contain (struct warnings_table const *table,
+                                        dev_t dev, ino_t ino);
+extern struct warnings_entry *
+warnings_table_lookup_dir (struct warnings_table *table, char const *path,
+                           struct stat const *st);
+extern struct warn_node *
+warnings_table_node (struct warnings_table *table, char const *dir);
+extern struct warn_node *
+warnings_node_child (struct warnings_table *table, struct warn_node *dir,
+                     char const *name);
+extern bool warnings_table_has_dirs (struct warnings_table const *table);
+extern bool warnings_table_all_seen (struct warnings_table *table);
+
+#endif